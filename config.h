@@ -9,10 +9,11 @@
  */
 
 /*
- * Sparse mode emulates a very large address space using a very sparse
- * table of "pages".  This enables testing of memory allocations that
- * would otherwise not be feasible.  Only used as a correctness test,
- * not for throughput or utilization
+ * Sparse mode emulates a very large heap by reserving address space
+ * without committing memory to it, so that only the pages actually
+ * touched take up memory.  This enables testing of memory allocations
+ * that would otherwise not be feasible.  Only used as a correctness
+ * test, not for throughput.  Build with "make SPARSE=1".
  */
 
 #ifndef SPARSE_MODE
@@ -131,27 +132,25 @@
  */
 #define TRY_DENSE_HEAP_START (void *) 0x800000000
 
+/*
+ * Size of a huge page; a heap backed by transparent huge pages is
+ * aligned to it
+ */
+#define HUGE_PAGE_SIZE (2UL<<20)  /* 2 MB */
+
 
 /*********** Parameters controlling sparse memory version of heap ***********/
 
 /*
- * Maximum heap size in bytes
+ * Maximum heap size in bytes; the heap gets the largest power-of-two
+ * fraction of this that the address space can reserve
  */
 #define MAX_SPARSE_HEAP (1UL<<62)  /* 1 EB */
 
 /*
- * Initial address of emulated heap
+ * Suggested starting address of the heap, taken only if the address
+ * space reaches it
  */
 #define SPARSE_HEAP_START (void *) 0x2130051300000000UL
 
-/*
- * Number of bytes in each page
- */
-#define SPARSE_PAGE_SIZE (1<<10)
-
-/*
- * Maximum target load for hash table
- */
-#define HASH_LOAD 10.0
-
 #endif /* __CONFIG_H */
@@ -21,6 +21,11 @@
 #include <stdbool.h>
 #include <math.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -36,6 +41,7 @@
 #define MAXLINE     1024          /* max string size */
 #define HDRLINES       4          /* number of header lines in a trace file */
 #define LINENUM(i) (i+HDRLINES+1) /* cnvt trace request nums to linenums (origin 1) */
+#define MT_MIN_SECS 0.02          /* min timed secs per thread count in -m mode */
 
 #ifndef REF_ONLY
 #define REF_ONLY 0
@@ -44,6 +50,10 @@
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
+/* Returns true if p is align-byte aligned, or ALIGNMENT-byte if align is 0 */
+#define IS_ALIGNED_TO(p, align) \
+    ((((unsigned long)(p)) % ((align) != 0 ? (align) : ALIGNMENT)) == 0)
+
 /* weights */
 typedef enum { WNONE, WALL, WUTIL, WPERF } weight_t;
 
@@ -81,9 +91,13 @@ typedef struct {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    enum { ALLOC, FREE, REALLOC, BATCH_ALLOC, BATCH_FREE } type; /* type of request */
     long index;                         /* index for free() to use later */
     size_t size;                        /* byte size of alloc/realloc request */
+    size_t count;                       /* number of blocks in a batch request,
+                                           from index on */
+    size_t align;                       /* alignment of an aligned alloc
+                                           request, 0 for plain malloc */
 } traceop_t;
 
 /* Holds the information for one trace file */
@@ -92,11 +106,14 @@ typedef struct {
     size_t data_bytes;    /* Peak number of data bytes allocated during trace */
     int num_ids;          /* number of alloc/realloc ids */
     int num_ops;          /* number of distinct requests */
+    double num_requests;  /* number of blocks requested or freed, counting
+                             every block of a batch */
     weight_t weight;      /* weight for this trace */
     traceop_t *ops;       /* array of requests */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
+    void **batch;         /* scratch array for the blocks of a batch */
 } trace_t;
 
 /*
@@ -123,13 +140,42 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    double rss_util;   /* peak payload over peak resident bytes, with every
+                          live payload page touched (negative if not known) */
+    double cache_hits; /* fraction of small requests served by the thread
+                          caches (negative for libc) */
+    double peak_size;  /* largest heap plus mapped bytes during the trace */
+    double final_size; /* heap plus mapped bytes after the last request */
+    int peak_op;       /* request after which the most payload was live */
+    double tlb_misses; /* dTLB read misses per op in one more timed
+                          replay, negative if they were not counted */
+    double cold_tput;  /* Kops of one replay on a freshly mapped heap ... */
+    double cold_faults; /* ... and the page faults per op it took */
+    mm_stats_t alloc_stats; /* counters at the end of the trace ... */
+    mm_stats_t peak_heap;   /* ... and the heap after request peak_op */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/*
+ * Holds the state of one worker thread in multithreaded mode. Each
+ * worker replays its own copy of the trace: the ops are shared, but the
+ * block arrays are private.
+ */
+typedef struct {
+    trace_t *trace;
+    int id;
+    bool check;                  /* stamp and verify block contents? */
+    bool valid;                  /* did the replay succeed? */
+    bool out_of_memory;          /* did it fail because the heap is full? */
+    double begin, end;           /* wall-clock bounds of the replay */
+    pthread_barrier_t *start;    /* released once all workers are ready */
+} mt_worker_t;
+
 /* Summarizes the key statistics for a set of traces */
 typedef struct {
     double util;  /* average utilization expressed as a percentage */
+    double rss_util; /* average utilization of resident bytes, or negative */
     double ops;   /* total number of operations */
     double secs;  /* total number of elapsed seconds */
     double tput;  /* average throughput expressed in Kops/s */
@@ -169,6 +215,59 @@ static size_t maxfill = SPARSE_MODE ? MAXFILL_SPARSE : MAXFILL;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* If positive, replay traces concurrently on up to this many threads */
+static int mt_threads = 0;
+
+/* If set, also run with deferred coalescing and compare (set by -q) */
+static bool compare_deferred = false;
+
+/* If set, also run with sized frees and compare (set by -z) */
+static bool compare_sized = false;
+
+/* If set, frees go through mm_free_sized during the current run */
+static bool sized_free = false;
+
+/* If set, also run with reallocs kept in usable space and compare (-u) */
+static bool compare_usable = false;
+
+/* If set, growing reallocs that fit the usable size are skipped */
+static bool usable_realloc = false;
+
+/* If set, also run with a huge-page heap and compare (set by -H) */
+static bool compare_huge = false;
+
+/* If set, print the allocator's statistics for each trace (set by -S) */
+static bool print_alloc_stats = false;
+
+/* Placement policy and scan cap handed to mm_set_policy (set by -P) */
+static mm_policy_t fit_policy = MM_FIT_GOOD;
+static int fit_cap = 0;
+
+/* If set, also run every trace under every policy (-P all) */
+static bool sweep_policies = false;
+
+/* Heap provider handed to mem_set_provider (set by -M) */
+static const char *heap_provider = "zero";
+
+/* If set, also run every trace on every heap provider (-M all) */
+static bool sweep_providers = false;
+
+/* If set, also time one replay per trace on a fresh heap */
+static bool measure_cold = false;
+
+/* Values a sweep matrix can show */
+typedef enum {
+    MATRIX_UTIL,        /* utilization */
+    MATRIX_KOPS,        /* throughput */
+    MATRIX_COLD_KOPS,   /* throughput on a fresh heap */
+    MATRIX_FAULTS       /* page faults per op on a fresh heap */
+} matrix_value_t;
+
+/* Names of the placement policies, as -P takes them */
+static const char *policy_names[MM_FIT_POLICIES] = {
+    "good", "first", "next", "best", "exact", "seg"
+};
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -223,11 +322,48 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats,
+                           int snapshot_op);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for the multithreaded scaling mode */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, int max_threads);
+static double eval_mm_mt(trace_t **copies, int nthreads, bool check,
+                         bool *valid, bool *out_of_memory);
+static void *mt_worker(void *ptr);
+static bool mt_check_block(mt_worker_t *w, int index);
+static void mt_stamp_block(mt_worker_t *w, int index);
+static double wall_time(void);
+static void touch_block(char *p, size_t size);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printstats(int n, stats_t *stats);
+static void compare_setting(const char *title, const char *label_a,
+                            const char *label_b, void (*set)(bool),
+                            speed_t *speed_params);
+static void set_sized_free(bool on);
+static void parse_policy(const char *arg);
+static void sweep_policy_matrix(speed_t *speed_params);
+static void sweep_provider_matrix(speed_t *speed_params);
+static void sweep_matrix(const char *title, const char **names, int m,
+                         void (*select)(int), const matrix_value_t *values,
+                         int num_values, speed_t *speed_params);
+static void print_matrix(const char *title, const char **names, int m,
+                         int n, stats_t *runs, matrix_value_t value);
+static void select_policy(int p);
+static void select_provider(int p);
+static void eval_mm_cold(speed_t *speed_params, stats_t *stats);
+static void set_usable_realloc(bool on);
+static double count_tlb_misses(speed_t *speed_params);
+static void print_comparison(const char *title, const char *label_a,
+                             const char *label_b, int n, stats_t *a,
+                             stats_t *b);
+static void free_traced(void *p, size_t size);
+static void *realloc_traced(void *p, size_t oldsize, size_t size);
+static void *mm_alloc_op(const traceop_t *op);
+static void *libc_alloc_op(const traceop_t *op);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -266,15 +402,16 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
         mem_init(sparse_mode);
-        range_set_t *ranges = new_range_set();
+        /* volatile: both live across the setjmp below */
+        range_set_t *volatile ranges = new_range_set();
 
 
         // NOTE: If times out, then it will reread the trace file
 
-        trace_t *trace;
+        trace_t *volatile trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+        mm_stats[i].ops = trace->num_requests;
 
         /* Prepare for timeout */
         if (setjmp(timeout_jmpbuf) != 0) {
@@ -294,13 +431,28 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i], -1);
+            size_t hits, lookups;
+            mm_cache_stats(&hits, &lookups);
+            mm_stats[i].cache_hits = lookups > 0 ? (double) hits / lookups : 0;
+            if (print_alloc_stats) {
+                /* Counters cover the whole trace; the heap is looked at
+                 * again where the most payload was live */
+                stats_t replay = mm_stats[i];
+                mm_get_stats(&mm_stats[i].alloc_stats);
+                eval_mm_util(trace, i, &replay, mm_stats[i].peak_op);
+                mm_stats[i].peak_heap = replay.peak_heap;
+            }
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs = sparse_mode ? 1.0 : fsec(eval_mm_speed, speed_params);
             mm_stats[i].tput = mm_stats[i].ops / (mm_stats[i].secs * 1000.0);
+            mm_stats[i].tlb_misses = compare_huge && !sparse_mode
+                ? count_tlb_misses(speed_params) / mm_stats[i].ops : -1;
+            if (measure_cold && !sparse_mode)
+                eval_mm_cold(speed_params, &mm_stats[i]);
         }
 
         free_trace(trace);
@@ -348,7 +500,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpOVAlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:m:s:t:v:hpquzOVAlDHM:P:ST")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -401,6 +553,45 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'q': /* Compare with deferred coalescing */
+            compare_deferred = true;
+            break;
+
+        case 'H': /* Compare with huge pages */
+            compare_huge = true;
+            break;
+
+        case 'M': /* Heap provider, or all of them */
+            if (strcmp(optarg, "all") == 0)
+                sweep_providers = true;
+            else if (!mem_set_provider(optarg))
+                app_error("-M takes zero, anon, memfd, file, populate or all\n");
+            else
+                heap_provider = optarg;
+            break;
+
+        case 'P': /* Placement policy, or all of them */
+            parse_policy(optarg);
+            break;
+
+        case 'S': /* Allocator statistics */
+            print_alloc_stats = true;
+            break;
+
+        case 'u': /* Compare with usable-size reallocs */
+            compare_usable = true;
+            break;
+
+        case 'z': /* Compare with sized frees */
+            compare_sized = true;
+            break;
+
+        case 'm': /* Multithreaded scaling mode */
+            mt_threads = atoi(optarg);
+            if (mt_threads < 1)
+                app_error("-m needs a positive thread count\n");
+            break;
+
         case 'T':
             tab_mode = true;
             break;
@@ -426,12 +617,23 @@ int main(int argc, char **argv)
         init_random_data();
     }
 
+    mm_set_policy(fit_policy, fit_cap);
+
     /* Initialize the timeout */
     if (set_timeout > 0) {
         signal(SIGALRM, timeout_handler);
         alarm(set_timeout);
     }
 
+    /*
+     * In multithreaded mode, only measure how throughput scales
+     */
+    if (mt_threads > 0) {
+        run_mt_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                     mt_threads);
+        exit(errors == 0 ? 0 : 1);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package
      */
@@ -451,6 +653,9 @@ int main(int argc, char **argv)
             if (verbose > 1)
                 printf("Checking libc malloc for correctness, ");
             libc_stats[i].valid = eval_libc_valid(trace);
+            libc_stats[i].cache_hits = -1;
+            libc_stats[i].rss_util = -1;
+            libc_stats[i].peak_size = -1;
             if (libc_stats[i].valid) {
                 speed_params.trace = trace;
                 if (verbose > 1)
@@ -479,8 +684,13 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
+    /* A one-time check with -z or -u takes the sized or usable paths */
+    sized_free = compare_sized && onetime_flag;
+    usable_realloc = compare_usable && onetime_flag;
     run_tests(num_global_tracefiles, tracedir, global_tracefiles, mm_stats,
               &speed_params);
+    sized_free = false;
+    usable_realloc = false;
 
 
     /* Display the mm results in a compact table */
@@ -497,9 +707,38 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (print_alloc_stats)
+                printstats(num_global_tracefiles, mm_stats);
         }
     }
 
+    /*
+     * Optionally rerun every trace with immediate and with deferred
+     * coalescing and show what deferring gains in throughput and costs
+     * in utilization; likewise for sized frees, and for reallocs that
+     * the usable size of a block absorbs.
+     */
+    if (compare_deferred && !onetime_flag)
+        compare_setting("Immediate vs deferred coalescing", "immed", "defer",
+                        mm_set_deferred_coalescing, &speed_params);
+    if (compare_sized && !onetime_flag)
+        compare_setting("Plain vs sized free", "plain", "sized",
+                        set_sized_free, &speed_params);
+    if (compare_usable && !onetime_flag)
+        compare_setting("Plain vs usable-size realloc", "plain", "usable",
+                        set_usable_realloc, &speed_params);
+    if (compare_huge && !onetime_flag) {
+        compare_setting("Small vs huge pages", "small", "huge",
+                        mem_set_huge_pages, &speed_params);
+        printf("Huge pages came from %s.%s\n\n", mem_page_backing(),
+               count_tlb_misses(NULL) < 0
+               ? " dTLB misses were not counted: no hardware counters." : "");
+    }
+    if (sweep_policies && !onetime_flag)
+        sweep_policy_matrix(&speed_params);
+    if (sweep_providers && !onetime_flag)
+        sweep_provider_matrix(&speed_params);
+
     /* Optionally compare the performance of mm and libc */
     if (run_libc) {
         printf("Comparison with libc malloc: mm/libc = %.0f Kops / %.0f Kops = %.2f\n",
@@ -602,6 +841,9 @@ int main(int argc, char **argv)
 #if !REF_ONLY
         if (!tab_mode) {
             printf("Average utilization = %.1f%%.\n", avg_mm_util * 100);
+            if (global_mm_sum_stats.rss_util >= 0)
+                printf("Average utilization of resident bytes = %.1f%%.\n",
+                       global_mm_sum_stats.rss_util * 100);
             printf("Average throughput (Kops/sec) = %.0f.\n",
                    avg_mm_geom_throughput);
         }
@@ -681,10 +923,20 @@ static range_set_t *new_range_set() {
  */
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
                       const trace_t *trace, int opnum, int index) {
-    char *hi = lo + size - 1;
-
     assert(size > 0);
 
+    /* The block may hold more than was asked for; all of it must be free
+     * for the caller to use, so the checks below cover all of it */
+    size_t usable = mm_malloc_usable_size(lo);
+    if (usable < size) {
+        malloc_error(trace, opnum,
+                     "Usable size %zu of payload %p is below the %zu bytes requested",
+                     usable, lo, size);
+        return false;
+    }
+    size = usable;
+    char *hi = lo + size - 1;
+
     /* Payload addresses must be ALIGNMENT-byte aligned */
     if (!IS_ALIGNED(lo)) {
         malloc_error(trace, opnum,
@@ -692,9 +944,11 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or of a
+     * mapping made through mem_map */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_in_mapping(lo, size)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -873,6 +1127,8 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     size_t size;
     int max_index = 0;
     int op_index;
+    size_t count, max_count = 0;
+    size_t align;
     int ignore = 0;
 
     if (verbose > 1)
@@ -923,7 +1179,9 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    trace->num_requests = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+        trace->ops[op_index].align = 0;
         switch(type[0]) {
         case 'a':
             ignore += fscanf(tracefile, "%u %lu", &index, &size);
@@ -932,6 +1190,17 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].size = size;
             max_index = (index > max_index) ? index : max_index;
             break;
+        case 'm':
+            ignore += fscanf(tracefile, "%u %lu %lu", &index, &align, &size);
+            if (align == 0 || (align & (align - 1)) != 0)
+                app_error("%s: alignment %lu is not a power of two",
+                          trace->filename, align);
+            trace->ops[op_index].type = ALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            trace->ops[op_index].align = align;
+            max_index = (index > max_index) ? index : max_index;
+            break;
         case 'r':
             ignore += fscanf(tracefile, "%u %lu", &index, &size);
             trace->ops[op_index].type = REALLOC;
@@ -944,10 +1213,31 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
             break;
+        case 'A':
+            ignore += fscanf(tracefile, "%u %lu %lu", &index, &count, &size);
+            trace->ops[op_index].type = BATCH_ALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            trace->ops[op_index].size = size;
+            index += count - 1;
+            max_index = (index > max_index) ? index : max_index;
+            max_count = (count > max_count) ? count : max_count;
+            break;
+        case 'F':
+            ignore += fscanf(tracefile, "%u %lu", &index, &count);
+            trace->ops[op_index].type = BATCH_FREE;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].count = count;
+            max_count = (count > max_count) ? count : max_count;
+            break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
                       type[0], trace->filename);
         }
+        if (type[0] == 'A' || type[0] == 'F')
+            trace->num_requests += count;
+        else
+            trace->num_requests++;
         op_index++;
         if (op_index == trace->num_ops) break;
     }
@@ -955,10 +1245,14 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
+    /* Room for the blocks of the biggest batch */
+    if ((trace->batch = malloc((max_count + 1) * sizeof(void *))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
+
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+    stats->ops = trace->num_requests;
 
     return trace;
 }
@@ -974,15 +1268,16 @@ static void reinit_trace(trace_t *trace)
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
+ * free_trace - Free the trace record and the five arrays it points
  *              to, all of which were allocated in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    free(trace->ops);         /* free the five arrays... */
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->batch);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -998,7 +1293,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 {
     int i;
     int index;
-    size_t size;
+    size_t size, count, j;
     char *newp;
     char *oldp;
     char *p;
@@ -1041,13 +1336,25 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_malloc */
+        case ALLOC: /* mm_malloc or mm_posix_memalign */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if (trace->ops[i].align != 0) {
+                if (mm_posix_memalign((void **)&p, trace->ops[i].align,
+                                      size) != 0) {
+                    malloc_error(trace, i, "mm_posix_memalign failed.");
+                    return false;
+                }
+            } else if ((p = mm_malloc(size)) == NULL) {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return false;
             }
+            if (!IS_ALIGNED_TO(p, trace->ops[i].align)) {
+                malloc_error(trace, i,
+                             "Payload address (%p) not aligned to %zu bytes",
+                             p, trace->ops[i].align);
+                return false;
+            }
 
             /*
              * Test the range of the new block for correctness and add it
@@ -1073,7 +1380,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 
             /* Call the student's realloc */
             oldp = trace->blocks[index];
-            newp = mm_realloc(oldp, size);
+            newp = realloc_traced(oldp, trace->block_sizes[index], size);
             if ( (newp == NULL) && (size != 0) ) {
                 malloc_error(trace, i, "mm_realloc failed.");
                 return false;
@@ -1125,7 +1432,37 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            free_traced(p, index < 0 ? 0 : trace->block_sizes[index]);
+            break;
+
+        case BATCH_ALLOC: /* mm_malloc_batch */
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, trace->batch) != count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return false;
+            }
+            for (j = 0; j < count; j++) {
+                p = trace->batch[j];
+                if (add_range(ranges, p, size, trace, i, index + j) == 0)
+                    return false;
+                trace->blocks[index + j] = p;
+                trace->block_sizes[index + j] = size;
+                randomize_block(trace, index + j);
+            }
+            break;
+
+        case BATCH_FREE: /* mm_free_batch */
+            count = trace->ops[i].count;
+            for (j = 0; j < count; j++) {
+                if (!check_index(trace, i, index + j))
+                {
+                    allCheck = false;
+                }
+                p = trace->blocks[index + j];
+                remove_range(ranges, p);
+                trace->batch[j] = p;
+            }
+            mm_free_batch(trace->batch, count);
             break;
 
         default:
@@ -1144,15 +1481,25 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   size of the heap in bytes after running the student's malloc
  *   package on the trace. Note that our implementation of mem_sbrk()
  *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   is always the high water mark of the heap. Blocks mapped outside
+ *   the heap through mem_map count too: heapsize is the peak of the
+ *   heap size plus the mapped bytes. Since the allocator may now give
+ *   memory back, the peak and the final footprint are recorded in stats.
+ *
+ *   The heap is reserved address space as much as memory, so the same
+ *   hwm is also set against the peak of the heap's resident bytes, as
+ *   memlib counts them with mincore. Every payload is touched page by
+ *   page when it is handed out, the way a program would fill it; pages
+ *   the allocator reserved but never used, or gave back, are not counted.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats,
+                           int snapshot_op)
 {
     int i;
     int index;
-    size_t size, newsize, oldsize;
+    size_t size, newsize, oldsize, count, j;
     size_t max_total_size = 0;
     size_t total_size = 0;
     char *p;
@@ -1160,8 +1507,13 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     reinit_trace(trace);
 
-    /* initialize the heap and the mm malloc package */
+    /* initialize the heap and the mm malloc package; resident pages are
+       counted from an untouched heap */
     mem_reset_brk();
+    if (!sparse_mode) {
+        mem_purge();
+        mem_track_resident(true);
+    }
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
@@ -1172,7 +1524,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = mm_alloc_op(&trace->ops[i])) == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1180,6 +1532,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             /* Remember region and size */
             trace->blocks[index] = p;
             trace->block_sizes[index] = size;
+            touch_block(p, size);
 
             total_size += size;
             break;
@@ -1190,7 +1543,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             oldsize = trace->block_sizes[index];
 
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
+            if ((newp = realloc_traced(oldp, oldsize, newsize)) == NULL
+                && newsize != 0) {
                 app_error("trace %d: mm_realloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1198,6 +1552,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             /* Remember region and size */
             trace->blocks[index] = newp;
             trace->block_sizes[index] = newsize;
+            touch_block(newp, newsize);
 
             total_size += (newsize - oldsize);
             break;
@@ -1212,26 +1567,83 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
-            mm_free(p);
+            free_traced(p, size);
 
             total_size -= size;
             break;
 
+        case BATCH_ALLOC: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, trace->batch) != count) {
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            }
+            for (j = 0; j < count; j++) {
+                trace->blocks[index + j] = trace->batch[j];
+                trace->block_sizes[index + j] = size;
+                touch_block(trace->batch[j], size);
+            }
+
+            total_size += count * size;
+            break;
+
+        case BATCH_FREE: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            for (j = 0; j < count; j++) {
+                trace->batch[j] = trace->blocks[index + j];
+                total_size -= trace->block_sizes[index + j];
+            }
+            mm_free_batch(trace->batch, count);
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
         }
 
         /* update the high-water mark */
-        max_total_size = (total_size > max_total_size) ?
-            total_size : max_total_size;
+        if (total_size > max_total_size) {
+            max_total_size = total_size;
+            stats->peak_op = i;
+        }
+        if (i == snapshot_op)
+            mm_get_stats(&stats->peak_heap);
     }
 
 #if !REF_ONLY
     printf(".");
 #endif
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    stats->peak_size = mem_peak_size();
+    stats->final_size = mem_heapsize() + mem_mapped_bytes();
+    stats->rss_util = -1;
+    if (!sparse_mode) {
+        stats->rss_util = (double)max_total_size / (double)mem_peak_resident();
+        mem_track_resident(false);
+    }
+    return ((double)max_total_size / (double)mem_peak_size());
+}
+
+/*
+ * touch_block - writes every page of a payload in place, as the program
+ *     that asked for it would, so that eval_mm_util sees it resident
+ */
+static void touch_block(char *p, size_t size)
+{
+    static size_t pagesize = 0;
+    volatile char *q;
+
+    if (sparse_mode || p == NULL || size == 0)
+        return;
+    if (pagesize == 0)
+        pagesize = mem_pagesize();
+    for (q = p; q < p + size; q += pagesize)
+        *q = *q;
+    q = p + size - 1;
+    *q = *q;
 }
 
 
@@ -1242,7 +1654,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 static void eval_mm_speed(void *ptr)
 {
     int i, index;
-    size_t size, newsize;
+    size_t size, newsize, count, j;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
@@ -1259,18 +1671,21 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm_alloc_op(&trace->ops[i])) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
             break;
 
         case REALLOC: /* mm_realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+            if ((newp = realloc_traced(oldp, trace->block_sizes[index],
+                                       newsize)) == NULL && newsize != 0)
                 app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
@@ -1280,7 +1695,25 @@ static void eval_mm_speed(void *ptr)
             } else {
                 block = trace->blocks[index];
             }
-            mm_free(block);
+            free_traced(block, index < 0 ? 0 : trace->block_sizes[index]);
+            break;
+
+        case BATCH_ALLOC: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, trace->batch) != count)
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            memcpy(&trace->blocks[index], trace->batch, count * sizeof(char *));
+            for (j = 0; j < count; j++)
+                trace->block_sizes[index + j] = size;
+            break;
+
+        case BATCH_FREE: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            memcpy(trace->batch, &trace->blocks[index], count * sizeof(char *));
+            mm_free_batch(trace->batch, count);
             break;
 
         default:
@@ -1297,7 +1730,7 @@ static void eval_mm_speed(void *ptr)
 static bool eval_libc_valid(trace_t *trace)
 {
     int i;
-    size_t newsize;
+    size_t newsize, j;
     char *p, *newp, *oldp;
 
     reinit_trace(trace);
@@ -1306,7 +1739,7 @@ static bool eval_libc_valid(trace_t *trace)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
+            if ((p = libc_alloc_op(&trace->ops[i])) == NULL) {
                 malloc_error(trace, i, "libc malloc failed");
                 unix_error("System message");
             }
@@ -1331,6 +1764,21 @@ static bool eval_libc_valid(trace_t *trace)
             }
             break;
 
+        case BATCH_ALLOC: /* one malloc per block */
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index + j] = p;
+            }
+            break;
+
+        case BATCH_FREE: /* one free per block */
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[trace->ops[i].index + j]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1348,7 +1796,7 @@ static void eval_libc_speed(void *ptr)
 {
     int i;
     int index;
-    size_t size, newsize;
+    size_t size, newsize, j;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -1359,7 +1807,7 @@ static void eval_libc_speed(void *ptr)
         case ALLOC: /* malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = malloc(size)) == NULL)
+            if ((p = libc_alloc_op(&trace->ops[i])) == NULL)
                 unix_error("malloc failed in eval_libc_speed");
             trace->blocks[index] = p;
             break;
@@ -1383,8 +1831,712 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case BATCH_ALLOC: /* one malloc per block */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+                trace->blocks[index + j] = p;
+            }
+            break;
+
+        case BATCH_FREE: /* one free per block */
+            index = trace->ops[i].index;
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[index + j]);
+            break;
+        }
+    }
+}
+
+/**********************************************************************
+ * The following functions measure how the throughput of the mm malloc
+ * package scales when several threads replay a trace at the same time.
+ **********************************************************************/
+
+/*
+ * run_mt_tests - For each trace, replay one private copy of it per
+ *     thread, for 1, 2, 4, ... up to max_threads threads, and print the
+ *     aggregate throughput and the speedup over a single thread. The
+ *     first run at each thread count stamps and verifies block contents
+ *     and checks the heap afterwards. A single replay is too short to
+ *     time on its own, so the timed runs repeat until they add up to at
+ *     least MT_MIN_SECS. A trace whose copies do not all fit in the heap
+ *     at once is shown as "--"; memlib keeps quiet about the failed
+ *     requests meanwhile, which would otherwise break up the table.
+ */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, int max_threads)
+{
+    const int min_runs = 3;
+    int counts[32];
+    int num_counts = 0;
+    int n, i, j, r;
+
+    for (n = 1; n < max_threads && num_counts < 31; n *= 2)
+        counts[num_counts++] = n;
+    counts[num_counts++] = max_threads;
+
+    printf("\nMultithreaded results for mm malloc "
+           "(Kops/sec over all threads, speedup over 1 thread):\n");
+    printf("%8s", "threads");
+    for (j = 0; j < num_counts; j++)
+        printf("%17d", counts[j]);
+    printf("  trace\n");
+
+    mem_report_errors(false);
+    for (i = 0; i < num_tracefiles; i++) {
+        stats_t stats;
+        mem_init(sparse_mode);
+        trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+
+        /* One private copy of the block arrays per thread */
+        trace_t **copies = malloc(max_threads * sizeof(trace_t *));
+        if (copies == NULL)
+            unix_error("malloc failed in run_mt_tests");
+        for (n = 0; n < max_threads; n++) {
+            copies[n] = malloc(sizeof(trace_t));
+            if (copies[n] == NULL)
+                unix_error("malloc failed in run_mt_tests");
+            *copies[n] = *trace;
+            copies[n]->blocks = calloc(trace->num_ids, sizeof(char *));
+            copies[n]->block_sizes = calloc(trace->num_ids, sizeof(size_t));
+            copies[n]->block_rand_base = NULL;
+            copies[n]->batch = calloc(trace->num_ids + 1, sizeof(void *));
+            if (copies[n]->blocks == NULL || copies[n]->block_sizes == NULL
+                || copies[n]->batch == NULL)
+                unix_error("calloc failed in run_mt_tests");
+        }
+
+        double base_tput = 0;
+        printf("%8s", "");
+        for (j = 0; j < num_counts; j++) {
+            bool valid, out_of_memory;
+            double secs = 0;
+            eval_mm_mt(copies, counts[j], true, &valid, &out_of_memory);
+            for (r = 0; valid && (r < min_runs || secs < MT_MIN_SECS); r++)
+                secs += eval_mm_mt(copies, counts[j], false, &valid,
+                                   &out_of_memory);
+            if (!valid) {
+                if (!out_of_memory)
+                    errors++;
+                printf("%17s", "--");
+                continue;
+            }
+            double tput = (double) counts[j] * r * trace->num_requests /
+                (secs * 1000.0);
+            if (counts[j] == 1)
+                base_tput = tput;
+            printf("%10.0f (%4.2fx)", tput,
+                   base_tput > 0 ? tput / base_tput : 0.0);
+        }
+        printf("  %s\n", trace->filename);
+
+        for (n = 0; n < max_threads; n++) {
+            free(copies[n]->blocks);
+            free(copies[n]->block_sizes);
+            free(copies[n]->batch);
+            free(copies[n]);
         }
+        free(copies);
+        free_trace(trace);
+        mem_deinit();
+    }
+    mem_report_errors(true);
+}
+
+/*
+ * eval_mm_mt - Reset the heap and replay copies[0..nthreads) on as many
+ *     threads at once. Returns the wall-clock time from the moment the
+ *     first thread starts replaying until the last one finishes.
+ */
+static double eval_mm_mt(trace_t **copies, int nthreads, bool check,
+                         bool *valid, bool *out_of_memory)
+{
+    pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
+    mt_worker_t *workers = malloc(nthreads * sizeof(mt_worker_t));
+    pthread_barrier_t start;
+    int n;
+
+    if (tids == NULL || workers == NULL)
+        unix_error("malloc failed in eval_mm_mt");
+
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_mt");
+
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (n = 0; n < nthreads; n++) {
+        workers[n].trace = copies[n];
+        workers[n].id = n;
+        workers[n].check = check;
+        workers[n].valid = true;
+        workers[n].out_of_memory = false;
+        workers[n].start = &start;
+        if (pthread_create(&tids[n], NULL, mt_worker, &workers[n]) != 0)
+            unix_error("pthread_create failed in eval_mm_mt");
+    }
+    pthread_barrier_wait(&start);
+    double begin = 0, end = 0;
+    *valid = true;
+    *out_of_memory = false;
+    for (n = 0; n < nthreads; n++) {
+        pthread_join(tids[n], NULL);
+        *valid = *valid && workers[n].valid;
+        *out_of_memory = *out_of_memory || workers[n].out_of_memory;
+        if (n == 0 || workers[n].begin < begin)
+            begin = workers[n].begin;
+        if (n == 0 || workers[n].end > end)
+            end = workers[n].end;
     }
+    double secs = end - begin;
+    pthread_barrier_destroy(&start);
+
+    if (check && *valid && !mm_checkheap(0)) {
+        printf("ERROR [trace %s, %d threads]: mm_checkheap returned false\n",
+               copies[0]->filename, nthreads);
+        *valid = false;
+    }
+    free(tids);
+    free(workers);
+    return secs;
+}
+
+/*
+ * mt_worker - Thread body: replay a private copy of the trace.
+ */
+static void *mt_worker(void *ptr)
+{
+    mt_worker_t *w = ptr;
+    trace_t *trace = w->trace;
+    int i, index;
+    size_t size, count, j;
+    char *p;
+
+    reinit_trace(trace);
+    pthread_barrier_wait(w->start);
+    w->begin = wall_time();
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+            p = mm_alloc_op(&trace->ops[i]);
+            if (p == NULL || !IS_ALIGNED_TO(p, trace->ops[i].align)) {
+                w->out_of_memory = (p == NULL);
+                w->valid = false;
+                return NULL;
+            }
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            if (w->check)
+                mt_stamp_block(w, index);
+            break;
+
+        case REALLOC:
+            if (w->check && !mt_check_block(w, index)) {
+                w->valid = false;
+                return NULL;
+            }
+            p = realloc_traced(trace->blocks[index],
+                               trace->block_sizes[index], size);
+            if ((p == NULL && size != 0) || !IS_ALIGNED(p)) {
+                w->out_of_memory = (p == NULL);
+                w->valid = false;
+                return NULL;
+            }
+            trace->blocks[index] = p;
+            if (size < trace->block_sizes[index])
+                trace->block_sizes[index] = size;
+            if (w->check && !mt_check_block(w, index)) {
+                w->valid = false;
+                return NULL;
+            }
+            trace->block_sizes[index] = size;
+            if (w->check)
+                mt_stamp_block(w, index);
+            break;
+
+        case FREE:
+            if (index < 0) {
+                mm_free(NULL);
+                break;
+            }
+            if (w->check && !mt_check_block(w, index)) {
+                w->valid = false;
+                return NULL;
+            }
+            free_traced(trace->blocks[index], trace->block_sizes[index]);
+            break;
+
+        case BATCH_ALLOC:
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, trace->batch) != count) {
+                w->out_of_memory = true;
+                w->valid = false;
+                return NULL;
+            }
+            for (j = 0; j < count; j++) {
+                p = trace->batch[j];
+                if (!IS_ALIGNED(p)) {
+                    w->valid = false;
+                    return NULL;
+                }
+                trace->blocks[index + j] = p;
+                trace->block_sizes[index + j] = size;
+                if (w->check)
+                    mt_stamp_block(w, index + j);
+            }
+            break;
+
+        case BATCH_FREE:
+            count = trace->ops[i].count;
+            for (j = 0; j < count; j++) {
+                if (w->check && !mt_check_block(w, index + j)) {
+                    w->valid = false;
+                    return NULL;
+                }
+                trace->batch[j] = trace->blocks[index + j];
+            }
+            mm_free_batch(trace->batch, count);
+            break;
+
+        default:
+            app_error("Nonexistent request type in mt_worker");
+        }
+    }
+    w->end = wall_time();
+    return NULL;
+}
+
+/*
+ * mt_stamp_block - Write a tag naming the owning thread and block index
+ *     into the first bytes of the block, so that blocks handed to two
+ *     threads at once are caught by mt_check_block.
+ */
+static void mt_stamp_block(mt_worker_t *w, int index)
+{
+    size_t len = w->trace->block_sizes[index];
+    uint64_t tag = ((uint64_t) w->id << 32) | (uint32_t) index;
+
+    if (len > sizeof(tag))
+        len = sizeof(tag);
+    if (len > 0)
+        mem_write(w->trace->blocks[index], tag, len);
+}
+
+/*
+ * mt_check_block - Verify the tag written by mt_stamp_block.
+ */
+static bool mt_check_block(mt_worker_t *w, int index)
+{
+    size_t len = w->trace->block_sizes[index];
+    uint64_t tag = ((uint64_t) w->id << 32) | (uint32_t) index;
+
+    if (len > sizeof(tag))
+        len = sizeof(tag);
+    if (len < sizeof(tag))
+        tag &= ((uint64_t) 1 << (8 * len)) - 1;
+    if (len > 0 && mem_read(w->trace->blocks[index], len) != tag) {
+        printf("ERROR [trace %s, thread %d]: block %d (at %p) was "
+               "overwritten\n", w->trace->filename, w->id, index,
+               w->trace->blocks[index]);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * wall_time - Seconds on the monotonic clock. The fcyc timers measure
+ *     per-thread CPU time, which would hide lock waits and idle threads.
+ */
+static double wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/*
+ * compare_setting - runs every trace with a setting off and on, through
+ *     set, and prints both side by side. The two runs of a trace go back
+ *     to back, so that both see the same machine state.
+ */
+static void compare_setting(const char *title, const char *label_a,
+                            const char *label_b, void (*set)(bool),
+                            speed_t *speed_params)
+{
+    int i;
+    stats_t *off_stats = calloc(num_global_tracefiles, sizeof(stats_t));
+    stats_t *on_stats = calloc(num_global_tracefiles, sizeof(stats_t));
+    if (off_stats == NULL || on_stats == NULL)
+        unix_error("calloc in compare_setting failed");
+    for (i = 0; i < num_global_tracefiles; i++) {
+        run_tests(1, tracedir, &global_tracefiles[i], &off_stats[i],
+                  speed_params);
+        set(true);
+        run_tests(1, tracedir, &global_tracefiles[i], &on_stats[i],
+                  speed_params);
+        set(false);
+    }
+    print_comparison(title, label_a, label_b, num_global_tracefiles,
+                     off_stats, on_stats);
+    free(off_stats);
+    free(on_stats);
+}
+
+/* set_sized_free - sends frees through mm_free_sized or mm_free */
+static void set_sized_free(bool on)
+{
+    sized_free = on;
+}
+
+/* set_usable_realloc - skips reallocs absorbed by the usable size or not */
+static void set_usable_realloc(bool on)
+{
+    usable_realloc = on;
+}
+
+/*
+ * count_tlb_misses - replays the trace once more, as eval_mm_speed does,
+ *     counting the dTLB read misses in user space; negative if the
+ *     counter is not available. Without a trace, only checks for it.
+ */
+static double count_tlb_misses(speed_t *speed_params)
+{
+    struct perf_event_attr attr;
+    uint64_t count;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0)
+        return -1;
+    if (speed_params == NULL) {
+        close(fd);
+        return 0;
+    }
+
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    eval_mm_speed(speed_params);
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return (double)count;
+}
+
+/*
+ * parse_policy - takes -P <name>[:<cap>], or -P all for the sweep
+ */
+static void parse_policy(const char *arg)
+{
+    int p;
+    size_t len = strcspn(arg, ":");
+
+    if (strcmp(arg, "all") == 0) {
+        sweep_policies = true;
+        return;
+    }
+    for (p = 0; p < MM_FIT_POLICIES; p++) {
+        if (strlen(policy_names[p]) == len
+            && strncmp(arg, policy_names[p], len) == 0)
+            break;
+    }
+    if (p == MM_FIT_POLICIES)
+        app_error("-P takes good, first, next, best, exact, seg or all\n");
+    fit_policy = (mm_policy_t)p;
+    if (arg[len] == ':') {
+        fit_cap = atoi(arg + len + 1);
+        if (fit_cap < 1)
+            app_error("-P needs a positive scan cap\n");
+    }
+}
+
+/*
+ * sweep_policy_matrix - runs every trace under every placement policy and
+ *     prints utilization and throughput as a trace by policy matrix; the
+ *     -P policy, if any, is put back at the end.
+ */
+static void sweep_policy_matrix(speed_t *speed_params)
+{
+    static const matrix_value_t values[] = { MATRIX_UTIL, MATRIX_KOPS };
+    sweep_matrix("Placement policies", policy_names, MM_FIT_POLICIES,
+                 select_policy, values, 2, speed_params);
+    mm_set_policy(fit_policy, fit_cap);
+}
+
+/*
+ * sweep_provider_matrix - runs every trace on every heap provider and
+ *     prints throughput, throughput of one replay on a freshly mapped
+ *     heap, and the page faults per op it took, each as a trace by
+ *     provider matrix; the -M provider is put back at the end.
+ */
+static void sweep_provider_matrix(speed_t *speed_params)
+{
+    static const matrix_value_t values[] = {
+        MATRIX_KOPS, MATRIX_COLD_KOPS, MATRIX_FAULTS
+    };
+    const char *names[16];
+    int m;
+
+    for (m = 0; m < 16 && mem_provider_name(m) != NULL; m++)
+        names[m] = mem_provider_name(m);
+    measure_cold = true;
+    sweep_matrix("Heap providers", names, m, select_provider, values, 3,
+                 speed_params);
+    measure_cold = false;
+    mem_set_provider(heap_provider);
+}
+
+/*
+ * sweep_matrix - runs every trace under each of m settings, chosen by
+ *     select, and prints each of the values as a trace by setting matrix.
+ *     The settings for a trace run back to back, as in compare_setting.
+ */
+static void sweep_matrix(const char *title, const char **names, int m,
+                         void (*select)(int), const matrix_value_t *values,
+                         int num_values, speed_t *speed_params)
+{
+    int i, p, n = num_global_tracefiles;
+    stats_t *runs = calloc((size_t)n * m, sizeof(stats_t));
+    if (runs == NULL)
+        unix_error("calloc in sweep_matrix failed");
+
+    for (i = 0; i < n; i++) {
+        for (p = 0; p < m; p++) {
+            select(p);
+            run_tests(1, tracedir, &global_tracefiles[i], &runs[i * m + p],
+                      speed_params);
+        }
+    }
+    for (i = 0; i < num_values; i++)
+        print_matrix(title, names, m, n, runs, values[i]);
+    printf("\n");
+    free(runs);
+}
+
+/*
+ * print_matrix - prints one value of n traces run under m settings, with
+ *     the average over the weighted traces that ran under all settings
+ */
+static void print_matrix(const char *title, const char **names, int m,
+                         int n, stats_t *runs, matrix_value_t value)
+{
+    static const char *headings[] = {
+        "util", "Kops", "Kops on a fresh heap", "page faults/op on a fresh heap"
+    };
+    int i, p, counted = 0;
+    double sum[m];
+
+    printf("\n%s, %s:\n", title, headings[value]);
+    for (p = 0; p < m; p++) {
+        printf("%9s", names[p]);
+        sum[p] = 0;
+    }
+    printf("  trace\n");
+    for (i = 0; i < n; i++) {
+        bool all_valid = runs[i * m].weight != WNONE;
+        for (p = 0; p < m; p++)
+            all_valid = all_valid && runs[i * m + p].valid;
+        for (p = 0; p < m; p++) {
+            stats_t *st = &runs[i * m + p];
+            double x = value == MATRIX_UTIL ? st->util * 100.0
+                : value == MATRIX_KOPS ? st->tput
+                : value == MATRIX_COLD_KOPS ? st->cold_tput : st->cold_faults;
+            if (all_valid)
+                sum[p] += x;
+            if (!st->valid)
+                printf("%9s", "-");
+            else if (value == MATRIX_UTIL)
+                printf("%8.1f%%", x);
+            else if (value == MATRIX_FAULTS)
+                printf("%9.3f", x);
+            else
+                printf("%9.0f", x);
+        }
+        printf("  %s\n", runs[i * m].filename);
+        counted += all_valid;
+    }
+    if (counted > 0) {
+        for (p = 0; p < m; p++) {
+            if (value == MATRIX_UTIL)
+                printf("%8.1f%%", sum[p] / counted);
+            else if (value == MATRIX_FAULTS)
+                printf("%9.3f", sum[p] / counted);
+            else
+                printf("%9.0f", sum[p] / counted);
+        }
+        printf("  average (weighted traces)\n");
+    }
+}
+
+/*
+ * select_policy - sweep_matrix setting p: placement policy p
+ */
+static void select_policy(int p)
+{
+    mm_set_policy((mm_policy_t)p, fit_cap);
+}
+
+/*
+ * select_provider - sweep_matrix setting p: heap provider p
+ */
+static void select_provider(int p)
+{
+    mem_set_provider(mem_provider_name(p));
+}
+
+/*
+ * eval_mm_cold - replays the trace once on a freshly mapped heap, timing
+ *     it and counting the page faults it takes, so that what the heap
+ *     provider costs on first touch shows
+ */
+static void eval_mm_cold(speed_t *speed_params, stats_t *stats)
+{
+    struct rusage before, after;
+
+    mem_deinit();
+    mem_init(sparse_mode);
+    getrusage(RUSAGE_SELF, &before);
+    double start = wall_time();
+    eval_mm_speed(speed_params);
+    double secs = wall_time() - start;
+    getrusage(RUSAGE_SELF, &after);
+    stats->cold_tput = stats->ops / (secs * 1000.0);
+    stats->cold_faults = (double)(after.ru_minflt - before.ru_minflt
+                                  + after.ru_majflt - before.ru_majflt)
+        / stats->ops;
+}
+
+/*
+ * print_comparison - prints utilization and throughput of every trace
+ *     under two settings a and b side by side.
+ */
+static void print_comparison(const char *title, const char *label_a,
+                             const char *label_b, int n, stats_t *a,
+                             stats_t *b)
+{
+    int i;
+    double util[2] = {0, 0}, tput[2] = {0, 0};
+    int counted = 0;
+
+    printf("\n%s:\n", title);
+    printf("%16s%16s%22s\n", "util", "Kops", "");
+    printf("%8s%8s%8s%8s%8s%8s  %s\n", label_a, label_b,
+           label_a, label_b, "speedup", "dutil", "trace");
+    for (i = 0; i < n; i++) {
+        if (!a[i].valid || !b[i].valid) {
+            printf("%8s%8s%8s%8s%8s%8s  %s\n", "-", "-", "-", "-", "-", "-",
+                   a[i].filename);
+            continue;
+        }
+        printf("%7.1f%%%7.1f%%%8.0f%8.0f%7.2fx%7.1f%%  %s\n",
+               a[i].util * 100.0, b[i].util * 100.0,
+               a[i].tput, b[i].tput,
+               b[i].tput / a[i].tput,
+               (b[i].util - a[i].util) * 100.0,
+               a[i].filename);
+        if (a[i].weight != WNONE) {
+            util[0] += a[i].util;
+            util[1] += b[i].util;
+            tput[0] += a[i].tput;
+            tput[1] += b[i].tput;
+            counted++;
+        }
+    }
+    if (counted > 0) {
+        printf("%7.1f%%%7.1f%%%8.0f%8.0f%7.2fx%7.1f%%  %s\n",
+               util[0] * 100.0 / counted, util[1] * 100.0 / counted,
+               tput[0] / counted, tput[1] / counted, tput[1] / tput[0],
+               (util[1] - util[0]) * 100.0 / counted, "average (weighted traces)");
+    }
+
+    /* dTLB misses, where they were counted */
+    for (i = 0; i < n; i++) {
+        if (a[i].valid && b[i].valid
+            && (a[i].tlb_misses >= 0 || b[i].tlb_misses >= 0))
+            break;
+    }
+    if (i < n) {
+        printf("\n%16s\n", "dTLB misses/op");
+        printf("%8s%8s  %s\n", label_a, label_b, "trace");
+        for (i = 0; i < n; i++) {
+            if (!a[i].valid || !b[i].valid)
+                continue;
+            if (a[i].tlb_misses >= 0)
+                printf("%8.3f", a[i].tlb_misses);
+            else
+                printf("%8s", "-");
+            if (b[i].tlb_misses >= 0)
+                printf("%8.3f", b[i].tlb_misses);
+            else
+                printf("%8s", "-");
+            printf("  %s\n", a[i].filename);
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * mm_alloc_op - serves an alloc request through mm_malloc, or through
+ *     mm_memalign if it asks for an alignment.
+ */
+static void *mm_alloc_op(const traceop_t *op)
+{
+    if (op->align != 0)
+        return mm_memalign(op->align, op->size);
+    return mm_malloc(op->size);
+}
+
+/*
+ * libc_alloc_op - the same with libc's malloc and aligned_alloc.
+ */
+static void *libc_alloc_op(const traceop_t *op)
+{
+    if (op->align != 0)
+        return aligned_alloc(op->align, op->size);
+    return malloc(op->size);
+}
+
+/*
+ * realloc_traced - resizes a trace block of oldsize bytes through
+ *     mm_realloc. In usable-size mode a block that grows within its
+ *     usable size is kept as is, the way a growable buffer fills its
+ *     slack before it calls realloc.
+ */
+static void *realloc_traced(void *p, size_t oldsize, size_t size)
+{
+    if (usable_realloc && p != NULL && size > oldsize
+        && size <= mm_malloc_usable_size(p))
+        return p;
+    return mm_realloc(p, size);
+}
+
+/*
+ * free_traced - frees a trace block through mm_free, or through
+ *     mm_free_sized with the size it was last requested with.
+ */
+static void free_traced(void *p, size_t size)
+{
+    if (sized_free)
+        mm_free_sized(p, size);
+    else
+        mm_free(p);
 }
 
 /*************************************
@@ -1405,18 +2557,21 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     double sumops  = 0;
     double sumtput = 0;
     double sumutil = 0;
+    double sumrss = 0;
     int sum_perf_weight = 0;
     int sum_util_weight = 0;
+    int sum_rss_weight = 0;
 
     char wstr;
     char *tabstr;
 
     /* Print the individual results for each trace */
     if (tab_mode) {
-        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace\n");
+        printf("valid\tthru?\tutil?\tutil\trss\tops\tmsecs\tKops\tcache\tpeakK\tfinalK\ttrace\n");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n",
-               "valid", "util", "ops", "msecs", "Kops", "trace");
+        printf("  %5s  %6s %7s %7s%8s%8s%7s%8s%8s  %s\n",
+               "valid", "util", "rss", "ops", "msecs", "Kops", "cache",
+               "peakK", "finalK", "trace");
     }
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
@@ -1464,6 +2619,15 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                     printf(" %8s", "--");
             }
 
+            /* Utilization by resident bytes */
+            if (tab_mode) {
+                printf("%.1f\t", stats[i].rss_util * 100.0);
+            } else if (stats[i].rss_util >= 0 && stats[i].weight != WPERF) {
+                printf(" %6.1f%%", stats[i].rss_util * 100.0);
+            } else {
+                printf(" %7s", "--");
+            }
+
             /* Ops + Time */
             double msecs = sparse_mode ? 0.0 : stats[i].secs * 1000.0;
             double kops = sparse_mode ? 0.0 : stats[i].tput;
@@ -1479,6 +2643,26 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                     printf("%8s%10s%7s ", "--", "--", "--");
             }
 
+            /* Thread cache hit rate */
+            if (tab_mode) {
+                printf("%.1f\t", stats[i].cache_hits * 100.0);
+            } else if (stats[i].cache_hits >= 0) {
+                printf("%6.1f%% ", stats[i].cache_hits * 100.0);
+            } else {
+                printf("%7s ", "--");
+            }
+
+            /* Peak and final footprint, in KiB */
+            if (tab_mode) {
+                printf("%.0f\t%.0f\t", stats[i].peak_size / 1024.0,
+                       stats[i].final_size / 1024.0);
+            } else if (stats[i].peak_size >= 0) {
+                printf("%7.0f %7.0f ", stats[i].peak_size / 1024.0,
+                       stats[i].final_size / 1024.0);
+            } else {
+                printf("%7s %7s ", "--", "--");
+            }
+
             printf("%s\n", stats[i].filename);
 
             if (stats[i].weight == WALL || stats[i].weight == WPERF)
@@ -1492,19 +2676,24 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                 {
                     sum_util_weight += 1;
                     sumutil += stats[i].util;
+                    if (stats[i].rss_util >= 0) {
+                        sum_rss_weight += 1;
+                        sumrss += stats[i].rss_util;
+                    }
                 }
         }
         else {
             if (tab_mode) {
-                printf("no\t\t\t\t\t\t\t%s\n", stats[i].filename);
+                printf("no\t\t\t\t\t\t\t\t\t\t\t%s\n", stats[i].filename);
             } else {
-                printf("%2s%4s%7s%10s%7s%10s %s\n",
+                printf("%2s%4s%7s%8s%10s%7s%10s %s\n",
                        stats[i].weight != 0 ? "*" : "",
                        "no",
                        "-",
                        "-",
                        "-",
                        "-",
+                       "-",
                        stats[i].filename);
             }
         }
@@ -1518,24 +2707,35 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             sum_util_weight = 1;
 
         double util = sumutil / (double)sum_util_weight;
+        double rss = sum_rss_weight > 0 ? sumrss / sum_rss_weight : -1;
         double tput = sparse_mode ? 0.0 : sumtput / (double)sum_perf_weight;
         if (sparse_mode)
             sumsecs = 0;
         if (tab_mode) {
             // "valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace"
-            printf("Sum\t%d\t%d\t%.1f\t%.0f\t\%.2f\n",
+            printf("Sum\t%d\t%d\t%.1f\t%.1f\t%.0f\t\%.2f\n",
                    sum_perf_weight,
                    sum_util_weight,
                    sumutil * 100.0,
+                   sumrss * 100.0,
+                   sumops,
+                   sumsecs * 1000.0);
+            printf("Avg\t\t\t%.1f\t%.1f\t\t\t\n",
+                   util * 100.0, rss * 100.0);
+        } else if (rss >= 0) {
+            printf("%2d %2d  %7.1f%% %6.1f%%%8.0f%10.3f\n",
+                   sum_util_weight,
+                   sum_perf_weight,
+                   util * 100.0,
+                   rss * 100.0,
                    sumops,
                    sumsecs * 1000.0);
-            printf("Avg\t\t\t%.1f\t\t\t\n",
-                   util * 100.0);
         } else {
-            printf("%2d %2d  %7.1f%%%8.0f%10.3f\n",
+            printf("%2d %2d  %7.1f%% %7s%8.0f%10.3f\n",
                    sum_util_weight,
                    sum_perf_weight,
                    util * 100.0,
+                   "--",
                    sumops,
                    sumsecs * 1000.0);
         }
@@ -1543,13 +2743,15 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         /* Record the summary statistics so we can compare libc and
            mm.cc */
         sumstats->util = util;
+        sumstats->rss_util = rss;
         sumstats->ops = sumops;
         sumstats->secs = sumsecs;
         sumstats->tput = tput;
     }
     else {
         if (!tab_mode) {
-            printf("     %8s%10s%7s\n",
+            printf("     %8s%8s%10s%7s\n",
+                   "-",
                    "-",
                    "-",
                    "-");
@@ -1558,12 +2760,77 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         /* Record the summary statistics so we can compare libc and
            mm.c */
         sumstats->util = 0;
+        sumstats->rss_util = -1;
         sumstats->ops = 0;
         sumstats->secs = 0;
         sumstats->tput = 0;
     }
 }
 
+/*
+ * printstats - prints the allocator's statistics for every valid trace:
+ *     the event counters over the whole trace, when mm.c counts them, and
+ *     the heap at the point where the most payload was live.
+ */
+static void printstats(int n, stats_t *stats)
+{
+    int i, c;
+
+    for (i = 0; i < n; i++) {
+        const mm_stats_t *s = &stats[i].alloc_stats;
+        const mm_stats_t *h = &stats[i].peak_heap;
+        if (!stats[i].valid)
+            continue;
+        printf("Allocator statistics for %s:\n", stats[i].filename);
+        if (s->counted) {
+            printf("  calls     malloc %zu  calloc %zu  realloc %zu  free %zu"
+                   "  free_sized %zu  memalign %zu  batch %zu/%zu\n",
+                   s->malloc_calls, s->calloc_calls, s->realloc_calls,
+                   s->free_calls, s->free_sized_calls, s->memalign_calls,
+                   s->malloc_batch_calls, s->free_batch_calls);
+            printf("  fit       searches %zu  steps %zu (%.2f per search)"
+                   "  capped %zu  misses %zu\n",
+                   s->fit_searches, s->fit_steps,
+                   s->fit_searches > 0
+                   ? (double)s->fit_steps / s->fit_searches : 0.0,
+                   s->fit_capped, s->fit_misses);
+            printf("  fit steps:");
+            for (c = 0; c < MM_STATS_DEPTHS; c++) {
+                if (s->fit_depth[c] != 0)
+                    printf(" %d%s:%zu", c, c == MM_STATS_DEPTHS - 1 ? "+" : "",
+                           s->fit_depth[c]);
+            }
+            printf("\n  fit excess by request size (fits/average bytes):");
+            for (c = 0; c < MM_STATS_CLASSES; c++) {
+                if (s->fit_hits[c] != 0)
+                    printf(" %lu+:%zu/%.0f", 1UL << c, s->fit_hits[c],
+                           (double)s->fit_waste[c] / s->fit_hits[c]);
+            }
+            printf("\n");
+            printf("  heap      extends %zu (%zuK)  trims %zu (%zuK)"
+                   "  splits %zu\n",
+                   s->extend_calls, s->extend_bytes / 1024,
+                   s->trim_calls, s->trim_bytes / 1024, s->splits);
+            printf("  coalesce  none %zu  next %zu  prev %zu  both %zu\n",
+                   s->coalesce[0], s->coalesce[1], s->coalesce[2],
+                   s->coalesce[3]);
+            printf("  realloc   copies %zu (%zuK)\n",
+                   s->realloc_copies, s->realloc_copy_bytes / 1024);
+        } else {
+            printf("  (no event counters; build mm.c with -DMM_STATS=1)\n");
+        }
+        printf("  at peak   request %d  heap %zuK  allocated %zuK  free %zuK\n",
+               stats[i].peak_op, h->heap_bytes / 1024,
+               h->allocated_bytes / 1024, h->free_bytes / 1024);
+        printf("  free blocks by size:");
+        for (c = 0; c < MM_STATS_CLASSES; c++) {
+            if (h->free_blocks[c] != 0)
+                printf(" %lu+:%zu", 1UL << c, h->free_blocks[c]);
+        }
+        printf("\n\n");
+    }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1697,6 +2964,16 @@ static void usage(char *prog)
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-m <n>     Replay traces on 1..n threads at once and report scaling.\n");
+    fprintf(stderr, "\t-q         Also run with deferred coalescing and compare.\n");
+    fprintf(stderr, "\t-z         Also run with sized frees and compare.\n");
+    fprintf(stderr, "\t-H         Also run with a huge-page heap and compare, with dTLB misses.\n");
+    fprintf(stderr, "\t-M <p>     Take the heap from provider zero, anon, memfd, file or populate;\n");
+    fprintf(stderr, "\t           all runs each and compares, also on fresh heaps.\n");
+    fprintf(stderr, "\t-u         Also run with reallocs kept within usable size and compare.\n");
+    fprintf(stderr, "\t-P <p>     Place blocks by policy good, first, next, best, exact or seg,\n");
+    fprintf(stderr, "\t           with :<n> to cap best fit scans; all runs each and compares.\n");
+    fprintf(stderr, "\t-S         Print allocator statistics for each trace.\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
 }
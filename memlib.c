@@ -3,10 +3,18 @@
  * because it allows us to interleave calls from the student's malloc
  * package with the system's malloc package in libc.
  *
- * This version has been updated to enable sparse emulation of very large heaps
+ * This version has been updated to enable sparse emulation of very large heaps:
+ * in sparse mode the heap and the mappings only reserve address space, and
+ * the kernel materializes a page the first time it is touched.
+ *
+ * Each heap lives in a mem_heap_t, with its own reservation, break and
+ * mappings, so several can be used side by side. The functions without a
+ * handle work on the default heap, the one mem_init sets up.
  */
+#define _GNU_SOURCE               /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -15,86 +23,242 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* Mappings handed out by mem_map, so that a reset can release them */
+typedef struct {
+    void *addr;
+    size_t size;
+} mapping_t;
+
+/* One simulated heap */
+struct mem_heap {
+    unsigned char *heap;            /* Starting address of heap */
+    unsigned char *mem_brk;         /* Current position of break */
+    unsigned char *mem_max_addr;    /* Maximum allowable heap address */
+    unsigned char *zero_lo;         /* Heap bytes from here on read as zero */
+    unsigned char *real_hwm;        /* Highest break the real sbrk has grown for */
+    size_t mmap_length;             /* Number of bytes allocated by mmap */
+    bool sparse;                    /* Reserve rather than allocate memory? */
+    bool heap_shared;               /* Is the heap a shared mapping? */
+    const char *page_backing;       /* What the heap got */
+    bool stats_printed;             /* Has information been printed about allocation */
+
+    mapping_t *mappings;            /* Live mappings, unordered */
+    size_t num_mappings;
+    size_t max_mappings;
+    size_t mapped_bytes;            /* Total size of live mappings */
+    size_t peak_size;               /* Max of heap size + mapped_bytes */
+    bool track_resident;            /* Note resident bytes before drops? */
+    size_t peak_resident;           /* Most resident bytes noted */
+    pthread_mutex_t map_lock;       /* Guards the fields from mappings on */
+};
+
 /* private global variables */
-static unsigned char *heap;                 /* Starting address of heap */
-static unsigned char *mem_brk;              /* Current position of break */
-static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
-static size_t mmap_length = MAX_DENSE_HEAP; /* Number of bytes allocated by mmap */
+static mem_heap_t default_heap = {         /* The heap of mem_init */
+    .map_lock = PTHREAD_MUTEX_INITIALIZER
+};
+static bool huge_pages = false;             /* Ask for huge pages for the heap? */
 static bool show_stats = false;             /* Should program print allocation information? */
-static bool stats_printed = false;          /* Has information been printed about allocation */
+static bool report_errors = true;           /* Print failed requests to stderr? */
 
-static void print_stats();
+/*
+ * Sources of memory for a dense heap. Each maps length zeroed bytes or
+ * returns MAP_FAILED; mem_sbrk and the rest work the same on all.
+ */
+typedef struct {
+    const char *name;
+    void *(*map)(size_t length);
+    bool shared;            /* must pages be punched out to read as zero? */
+} provider_t;
+
+static void *map_dev_zero(size_t length);
+static void *map_anon(size_t length);
+static void *map_memfd(size_t length);
+static void *map_file(size_t length);
+static void *map_populate(size_t length);
+
+static const provider_t providers[] = {
+    { "zero", map_dev_zero, false },     /* private mapping of /dev/zero */
+    { "anon", map_anon, false },         /* anonymous memory */
+    { "memfd", map_memfd, true },        /* shared memory file */
+    { "file", map_file, true },          /* unlinked file in TMPDIR */
+    { "populate", map_populate, false }, /* anonymous, faulted in up front */
+};
+#define NUM_PROVIDERS (sizeof(providers) / sizeof(providers[0]))
+
+static const provider_t *provider = &providers[0];
+
+static bool heap_init(mem_heap_t *h, bool sparse_mode);
+static void report_error(const char *fmt, ...);
+static void print_stats(mem_heap_t *h);
+static void *map_huge(size_t length, const char **backing);
+static void unmap_all(mem_heap_t *h);
+static void clear_range(mem_heap_t *h, unsigned char *lo, unsigned char *hi);
+static void update_peak(mem_heap_t *h);
+static size_t resident_bytes(mem_heap_t *h);
+static size_t resident_in(const void *addr, size_t len);
+static void note_resident(mem_heap_t *h);
+static mapping_t *find_mapping(mem_heap_t *h, void *addr);
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model. A sparse heap reserves
+ *            as much of MAX_SPARSE_HEAP as the address space holds,
+ *            without committing memory to it.
  */
-void mem_init(){
-    /* Dense allocation */
-    mmap_length = MAX_DENSE_HEAP;
-
-    int dev_zero = open("/dev/zero", O_RDWR);
-    void *start = TRY_DENSE_HEAP_START;
-    void *addr = mmap(start,        /* suggested start*/
-                      mmap_length,  /* length */
-                      PROT_WRITE,   /* permissions */
-                      MAP_PRIVATE,  /* private or shared? */
-                      dev_zero,            /* fd */
-                      0);            /* offset */
-    if (addr == MAP_FAILED) {
+void mem_init(bool sparse_mode){
+    if (!heap_init(&default_heap, sparse_mode)) {
         fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
         exit(1);
     }
-    
-    heap = addr;
-    mem_max_addr = heap + MAX_DENSE_HEAP;
-    
-    stats_printed = false;
-    mem_brk = heap;
-    mem_reset_brk();
+}
+
+/*
+ * mem_heap_create - set up an empty heap of its own, next to the default
+ *                   one and any others, as mem_init does. Returns NULL if
+ *                   there is no room for it.
+ */
+mem_heap_t *mem_heap_create(bool sparse_mode) {
+    mem_heap_t *h = calloc(1, sizeof(mem_heap_t));
+    if (h == NULL)
+        return NULL;
+    pthread_mutex_init(&h->map_lock, NULL);
+    if (!heap_init(h, sparse_mode)) {
+        pthread_mutex_destroy(&h->map_lock);
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+/*
+ * mem_heap_destroy - release a heap made by mem_heap_create, with its
+ *                    mappings
+ */
+void mem_heap_destroy(mem_heap_t *h) {
+    mem_heap_deinit(h);
+    pthread_mutex_destroy(&h->map_lock);
+    free(h->mappings);
+    free(h);
+}
+
+/*
+ * mem_default_heap - returns the heap of mem_init, which the functions
+ *                    without a handle work on
+ */
+mem_heap_t *mem_default_heap(void) {
+    return &default_heap;
+}
+
+/*
+ * mem_set_huge_pages - back the dense heaps set up from now on with
+ *                      huge pages: explicit ones if the system has any
+ *                      reserved, and otherwise transparent ones
+ */
+void mem_set_huge_pages(bool on) {
+    huge_pages = on;
+}
+
+/*
+ * mem_set_provider - take the dense heaps set up from now on from the
+ *                    named provider; false if there is none by that name
+ */
+bool mem_set_provider(const char *name) {
+    size_t i;
+    for (i = 0; i < NUM_PROVIDERS; i++) {
+        if (strcmp(providers[i].name, name) == 0) {
+            provider = &providers[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * mem_provider_name - returns the name of provider i, or NULL if there
+ *                     are no more
+ */
+const char *mem_provider_name(int i) {
+    return i >= 0 && (size_t) i < NUM_PROVIDERS ? providers[i].name : NULL;
+}
+
+/*
+ * mem_heap_page_backing - returns what backs a heap
+ */
+const char *mem_heap_page_backing(mem_heap_t *h) {
+    return h->page_backing;
 }
 
 /* 
- * mem_deinit - free the storage used by the memory system model
+ * mem_heap_deinit - free the storage of a heap, leaving the handle to be
+ *                   set up again or destroyed
  */
-void mem_deinit(void){
-    print_stats();
-    munmap(heap, mmap_length);
+void mem_heap_deinit(mem_heap_t *h) {
+    print_stats(h);
+    unmap_all(h);
+    munmap(h->heap, h->mmap_length);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_heap_reset_brk - reset the simulated brk pointer to make an empty
+ *                      heap, releasing every mapping made by mem_map. The
+ *                      old heap contents are left in place, so they no
+ *                      longer count as zero.
  */
-void mem_reset_brk(){
-    print_stats();
-    mem_brk = heap;
+void mem_heap_reset_brk(mem_heap_t *h) {
+    print_stats(h);
+    h->mem_brk = h->heap;
+    unmap_all(h);
+    h->peak_size = 0;
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *                by incr bytes and returns the start address of the new area. In
- *                this model, the heap cannot be shrunk.
+ * mem_heap_sbrk - simple model of the sbrk function. Extends the heap 
+ *                by incr bytes and returns the start address of the new area. A
+ *                negative incr shrinks the heap, down to empty at the most, and
+ *                returns the old break. Bytes given back this way read as zero
+ *                again, as long as everything above them already did.
  */
-void *mem_sbrk(intptr_t incr) {
-    unsigned char *old_brk = mem_brk;
+void *mem_heap_sbrk(mem_heap_t *h, intptr_t incr) {
+    unsigned char *old_brk = h->mem_brk;
 
     bool ok = true;
-    if (incr < 0) {
+    if (incr < 0 && (size_t) -incr > (size_t) (h->mem_brk - h->heap)) {
         ok = false;
-        fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+        report_error("ERROR: mem_sbrk failed.  Attempt to shrink heap by %ld bytes, below its start\n", (long) -incr);
+    } else if (incr > 0 && h->mem_brk + incr > h->mem_max_addr) {
         ok = false;
-        size_t alloc = mem_brk - heap + incr;
-        fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
-    } else if (sbrk(incr) == (void*) -1) {
+        size_t alloc = h->mem_brk - h->heap + incr;
+        report_error("ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
+    /* Never shrink the real break: libc's heap may lie beyond ours. It
+     * only grows with the heap's high-water mark, so that a heap trimmed
+     * and grown again does not push it up each time. */
+    } else if (incr > 0 && !h->sparse && h->mem_brk + incr > h->real_hwm
+               && sbrk(h->mem_brk + incr - h->real_hwm) == (void*) -1) {
         ok = false;
-        fprintf(stderr, "ERROR: mem_sbrk failed.  Could not allocate more heap space\n");
+        report_error("ERROR: mem_sbrk failed.  Could not allocate more heap space\n");
     }
     if (ok) {
-        mem_brk += incr;
+        if (incr < 0 && h->track_resident) {
+            pthread_mutex_lock(&h->map_lock);
+            note_resident(h);
+            pthread_mutex_unlock(&h->map_lock);
+        }
+        h->mem_brk += incr;
+        if (h->mem_brk > h->real_hwm)
+            h->real_hwm = h->mem_brk;
+        if (incr < 0 && h->zero_lo == old_brk) {
+            clear_range(h, h->mem_brk, old_brk);
+            h->zero_lo = h->mem_brk;
+        } else if (h->mem_brk > h->zero_lo) {
+            h->zero_lo = h->mem_brk;
+        }
+        pthread_mutex_lock(&h->map_lock);
+        update_peak(h);
+        pthread_mutex_unlock(&h->map_lock);
         return (void *) old_brk;
     } else {
         errno = ENOMEM;
@@ -103,24 +267,32 @@ void *mem_sbrk(intptr_t incr) {
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_heap_first - return address of the first heap byte
  */
-void *mem_heap_lo(){
-    return (void *) heap;
+void *mem_heap_first(mem_heap_t *h) {
+    return (void *) h->heap;
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_last - return address of last heap byte
  */
-void *mem_heap_hi(){
-    return (void *)(mem_brk - 1);
+void *mem_heap_last(mem_heap_t *h) {
+    return (void *)(h->mem_brk - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heap_zero_lo - return the lowest address from which the heap area
+ *                    reads as zero; never below the break
  */
-size_t mem_heapsize() {
-    return (size_t)(mem_brk - heap);
+void *mem_heap_zero_lo(mem_heap_t *h) {
+    return (void *) h->zero_lo;
+}
+
+/*
+ * mem_heap_size - returns the heap size in bytes
+ */
+size_t mem_heap_size(mem_heap_t *h) {
+    return (size_t)(h->mem_brk - h->heap);
 }
 
 /*
@@ -130,17 +302,452 @@ size_t mem_pagesize(){
     return (size_t) sysconf(_SC_PAGESIZE);
 }
 
+/*
+ * mem_report_errors - print why a request failed to stderr, as by
+ *                     default, or fail quietly
+ */
+void mem_report_errors(bool on) {
+    report_errors = on;
+}
+
+
+/*
+ * mem_heap_map - map size bytes, rounded up to whole pages, of zeroed
+ *                memory outside the heap, on the heap's account. Returns
+ *                the page-aligned start, or NULL. In sparse mode only the
+ *                address space is reserved.
+ */
+void *mem_heap_map(mem_heap_t *h, size_t size) {
+    size_t pagesize = mem_pagesize();
+    if (size > SIZE_MAX - pagesize) {
+        report_error("ERROR: mem_map failed.  Could not map %zu bytes\n", size);
+        return NULL;
+    }
+    size = (size + pagesize - 1) / pagesize * pagesize;
+
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | (h->sparse ? MAP_NORESERVE : 0),
+                      -1, 0);
+    if (addr == MAP_FAILED) {
+        report_error("ERROR: mem_map failed.  Could not map %zu bytes\n", size);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&h->map_lock);
+    if (h->num_mappings == h->max_mappings) {
+        size_t new_max = h->max_mappings == 0 ? 64 : 2 * h->max_mappings;
+        mapping_t *new_mappings = realloc(h->mappings, new_max * sizeof(mapping_t));
+        if (new_mappings == NULL) {
+            pthread_mutex_unlock(&h->map_lock);
+            munmap(addr, size);
+            return NULL;
+        }
+        h->mappings = new_mappings;
+        h->max_mappings = new_max;
+    }
+    h->mappings[h->num_mappings].addr = addr;
+    h->mappings[h->num_mappings].size = size;
+    h->num_mappings++;
+    h->mapped_bytes += size;
+    update_peak(h);
+    pthread_mutex_unlock(&h->map_lock);
+    return addr;
+}
+
+/*
+ * mem_heap_remap - resize a mapping made by mem_heap_map to new_size
+ *                  bytes, rounded up to whole pages, moving it if need be.
+ *                  Returns the new start, or NULL with the old mapping
+ *                  left intact.
+ */
+void *mem_heap_remap(mem_heap_t *h, void *addr, size_t old_size, size_t new_size) {
+    size_t pagesize = mem_pagesize();
+    if (new_size > SIZE_MAX - pagesize) {
+        report_error("ERROR: mem_remap failed.  Could not remap to %zu bytes\n", new_size);
+        return NULL;
+    }
+    new_size = (new_size + pagesize - 1) / pagesize * pagesize;
+
+    pthread_mutex_lock(&h->map_lock);
+    mapping_t *m = find_mapping(h, addr);
+    assert(m != NULL && m->size == (old_size + pagesize - 1) / pagesize * pagesize);
+    if (new_size < m->size && h->track_resident)
+        note_resident(h);
+    void *new_addr = mremap(addr, m->size, new_size, MREMAP_MAYMOVE);
+    if (new_addr == MAP_FAILED) {
+        pthread_mutex_unlock(&h->map_lock);
+        report_error("ERROR: mem_remap failed.  Could not remap to %zu bytes\n", new_size);
+        return NULL;
+    }
+    h->mapped_bytes += new_size - m->size;
+    m->addr = new_addr;
+    m->size = new_size;
+    update_peak(h);
+    pthread_mutex_unlock(&h->map_lock);
+    return new_addr;
+}
+
+/*
+ * mem_heap_unmap - release a mapping made by mem_heap_map
+ */
+void mem_heap_unmap(mem_heap_t *h, void *addr, size_t size) {
+    pthread_mutex_lock(&h->map_lock);
+    mapping_t *m = find_mapping(h, addr);
+    assert(m != NULL);
+    if (h->track_resident)
+        note_resident(h);
+    size = m->size;
+    h->mapped_bytes -= size;
+    *m = h->mappings[--h->num_mappings];
+    pthread_mutex_unlock(&h->map_lock);
+    munmap(addr, size);
+}
+
+/*
+ * mem_heap_mapped_bytes - returns the total size of a heap's live mappings
+ */
+size_t mem_heap_mapped_bytes(mem_heap_t *h) {
+    return h->mapped_bytes;
+}
+
+/*
+ * mem_heap_in_mapping - tells whether the len bytes at addr lie within a
+ *                       single live mapping of the heap
+ */
+bool mem_heap_in_mapping(mem_heap_t *h, const void *addr, size_t len) {
+    const char *lo = addr;
+    bool found = false;
+    size_t i;
+
+    pthread_mutex_lock(&h->map_lock);
+    for (i = 0; i < h->num_mappings && !found; i++) {
+        const char *start = h->mappings[i].addr;
+        found = lo >= start && lo + len <= start + h->mappings[i].size;
+    }
+    pthread_mutex_unlock(&h->map_lock);
+    return found;
+}
+
+/*
+ * mem_heap_peak_size - returns the largest heap size plus mapped bytes
+ *                      seen since the last reset
+ */
+size_t mem_heap_peak_size(mem_heap_t *h) {
+    return h->peak_size;
+}
+
+/*
+ * mem_heap_purge - drop the pages of the heap area above the break, as if
+ *                  it had never been touched; they read as zero again
+ */
+void mem_heap_purge(mem_heap_t *h) {
+    if (h->zero_lo > h->mem_brk) {
+        clear_range(h, h->mem_brk, h->zero_lo);
+        h->zero_lo = h->mem_brk;
+    }
+}
+
+/*
+ * mem_heap_resident_bytes - returns how many bytes of the heap and of its
+ *                           live mappings are resident, by whole pages
+ */
+size_t mem_heap_resident_bytes(mem_heap_t *h) {
+    pthread_mutex_lock(&h->map_lock);
+    size_t bytes = resident_bytes(h);
+    pthread_mutex_unlock(&h->map_lock);
+    return bytes;
+}
+
+/*
+ * mem_heap_track_resident - start tracking the most resident bytes, from
+ *                           the present, or stop. Resident bytes are
+ *                           looked at before every drop of pages, so the
+ *                           peak is exact as long as nothing else gives
+ *                           pages back.
+ */
+void mem_heap_track_resident(mem_heap_t *h, bool on) {
+    pthread_mutex_lock(&h->map_lock);
+    h->track_resident = on;
+    h->peak_resident = 0;
+    if (on)
+        note_resident(h);
+    pthread_mutex_unlock(&h->map_lock);
+}
+
+/*
+ * mem_heap_peak_resident - returns the most resident bytes since tracking
+ *                          began, counting the present
+ */
+size_t mem_heap_peak_resident(mem_heap_t *h) {
+    pthread_mutex_lock(&h->map_lock);
+    note_resident(h);
+    size_t bytes = h->peak_resident;
+    pthread_mutex_unlock(&h->map_lock);
+    return bytes;
+}
+
+/*
+ * The default heap: each function below is its mem_heap_ counterpart on
+ * the heap of mem_init
+ */
+const char *mem_page_backing() { return mem_heap_page_backing(&default_heap); }
+void mem_deinit(void) { mem_heap_deinit(&default_heap); }
+void mem_reset_brk() { mem_heap_reset_brk(&default_heap); }
+void *mem_sbrk(intptr_t incr) { return mem_heap_sbrk(&default_heap, incr); }
+void *mem_heap_lo() { return mem_heap_first(&default_heap); }
+void *mem_heap_hi() { return mem_heap_last(&default_heap); }
+void *mem_zero_lo() { return mem_heap_zero_lo(&default_heap); }
+size_t mem_heapsize() { return mem_heap_size(&default_heap); }
+void *mem_map(size_t size) { return mem_heap_map(&default_heap, size); }
+void *mem_remap(void *addr, size_t old_size, size_t new_size) {
+    return mem_heap_remap(&default_heap, addr, old_size, new_size);
+}
+void mem_unmap(void *addr, size_t size) { mem_heap_unmap(&default_heap, addr, size); }
+size_t mem_mapped_bytes() { return mem_heap_mapped_bytes(&default_heap); }
+bool mem_in_mapping(const void *addr, size_t len) {
+    return mem_heap_in_mapping(&default_heap, addr, len);
+}
+size_t mem_peak_size() { return mem_heap_peak_size(&default_heap); }
+void mem_purge() { mem_heap_purge(&default_heap); }
+size_t mem_resident_bytes() { return mem_heap_resident_bytes(&default_heap); }
+void mem_track_resident(bool on) { mem_heap_track_resident(&default_heap, on); }
+size_t mem_peak_resident() { return mem_heap_peak_resident(&default_heap); }
+
 
 /*************** Private Functions *******************/
 
+/*
+ * Reserve and set up an empty heap in h; false if no room was found.
+ * Each heap gets a reservation of its own: the start addresses in
+ * config.h are only hints, so a second heap lands wherever there is room.
+ */
+static bool heap_init(mem_heap_t *h, bool sparse_mode) {
+    void *addr = MAP_FAILED;
+    size_t length;
+
+    h->sparse = sparse_mode;
+    h->page_backing = "4K pages";
+    h->heap_shared = false;
+    if (sparse_mode) {
+        for (length = MAX_SPARSE_HEAP; length >= MAX_DENSE_HEAP; length /= 2) {
+            addr = mmap(SPARSE_HEAP_START, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (addr != MAP_FAILED)
+                break;
+        }
+    } else {
+        /* Dense allocation */
+        length = MAX_DENSE_HEAP;
+        addr = huge_pages ? map_huge(length, &h->page_backing) : MAP_FAILED;
+        if (addr == MAP_FAILED) {
+            addr = provider->map(length);
+            h->heap_shared = provider->shared;
+        }
+    }
+    if (addr == MAP_FAILED)
+        return false;
+
+    h->heap = addr;
+    h->mmap_length = length;
+    h->mem_max_addr = h->heap + length;
+    h->stats_printed = false;
+    h->mem_brk = h->heap;
+    h->zero_lo = h->heap;
+    h->real_hwm = h->heap;
+    h->track_resident = false;
+    h->peak_resident = 0;
+    mem_heap_reset_brk(h);
+    return true;
+}
+
+/* Print a failed request to stderr, unless errors are not reported */
+static void report_error(const char *fmt, ...) {
+    va_list ap;
+    if (!report_errors)
+        return;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+/* Release every live mapping of a heap */
+static void unmap_all(mem_heap_t *h) {
+    pthread_mutex_lock(&h->map_lock);
+    while (h->num_mappings > 0) {
+        h->num_mappings--;
+        munmap(h->mappings[h->num_mappings].addr, h->mappings[h->num_mappings].size);
+    }
+    h->mapped_bytes = 0;
+    pthread_mutex_unlock(&h->map_lock);
+}
+
+/*
+ * Zero [lo, hi): the physical pages wholly inside are dropped, so they
+ * read back as zero, and the partial pages at either end are cleared
+ */
+static void clear_range(mem_heap_t *h, unsigned char *lo, unsigned char *hi) {
+    uintptr_t pagesize = mem_pagesize();
+    uintptr_t start = ((uintptr_t) lo + pagesize - 1) / pagesize * pagesize;
+    uintptr_t end = (uintptr_t) hi / pagesize * pagesize;
+    if (start < end) {
+        memset(lo, 0, (unsigned char *) start - lo);
+        /* Shared pages must be punched out of their file, and explicit
+         * huge pages can only be dropped whole */
+        if (madvise((void *) start, end - start,
+                    h->heap_shared ? MADV_REMOVE : MADV_DONTNEED) != 0)
+            memset((void *) start, 0, end - start);
+        memset((void *) end, 0, hi - (unsigned char *) end);
+    } else {
+        memset(lo, 0, hi - lo);
+    }
+}
+
+/* Providers: a private mapping of /dev/zero */
+static void *map_dev_zero(size_t length) {
+    int dev_zero = open("/dev/zero", O_RDWR);
+    void *start = TRY_DENSE_HEAP_START;
+    void *addr = mmap(start,        /* suggested start*/
+                      length,       /* length */
+                      PROT_WRITE,   /* permissions */
+                      MAP_PRIVATE,  /* private or shared? */
+                      dev_zero,     /* fd */
+                      0);           /* offset */
+    close(dev_zero);
+    return addr;
+}
+
+/* Providers: anonymous memory */
+static void *map_anon(size_t length) {
+    return mmap(TRY_DENSE_HEAP_START, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+/* Providers: anonymous memory with every page faulted in up front */
+static void *map_populate(size_t length) {
+    return mmap(TRY_DENSE_HEAP_START, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+}
+
+/* Providers: a shared mapping of a length-byte file, closed once mapped */
+static void *map_fd(int fd, size_t length) {
+    void *addr = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, length) == 0)
+        addr = mmap(TRY_DENSE_HEAP_START, length, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    return addr;
+}
+
+/* Providers: a memory-backed file from memfd_create */
+static void *map_memfd(size_t length) {
+    return map_fd(memfd_create("mdriver-heap", MFD_CLOEXEC), length);
+}
+
+/* Providers: a file in TMPDIR, unlinked at once */
+static void *map_file(size_t length) {
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/mdriver-heap-XXXXXX",
+             dir != NULL ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    return map_fd(fd, length);
+}
+
+/*
+ * Map length bytes of huge pages: explicit ones if they can be had, or
+ * else a reservation aligned to HUGE_PAGE_SIZE and advised to use
+ * transparent ones. Returns MAP_FAILED if neither can be mapped, and
+ * what backs the mapping in *backing.
+ */
+static void *map_huge(size_t length, const char **backing) {
+    void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED) {
+        *backing = "hugetlb";
+        return addr;
+    }
+
+    unsigned char *raw = mmap(NULL, length + HUGE_PAGE_SIZE,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return MAP_FAILED;
+    unsigned char *start = (unsigned char *)
+        (((uintptr_t) raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if (start > raw)
+        munmap(raw, start - raw);
+    munmap(start + length, raw + HUGE_PAGE_SIZE - start);
+    *backing = madvise(start, length, MADV_HUGEPAGE) == 0
+        ? "THP" : "4K pages";
+    return start;
+}
+
+/* Fold the current footprint into the peak; map_lock must be held */
+static void update_peak(mem_heap_t *h) {
+    size_t size = mem_heap_size(h) + h->mapped_bytes;
+    if (size > h->peak_size)
+        h->peak_size = size;
+}
+
+/* Resident bytes of the heap and the mappings; map_lock must be held */
+static size_t resident_bytes(mem_heap_t *h) {
+    size_t bytes = resident_in(h->heap, mem_heap_size(h));
+    size_t i;
+    for (i = 0; i < h->num_mappings; i++)
+        bytes += resident_in(h->mappings[i].addr, h->mappings[i].size);
+    return bytes;
+}
+
+/* Resident bytes of the pages holding [addr, addr + len), by mincore */
+static size_t resident_in(const void *addr, size_t len) {
+    unsigned char vec[4096];
+    size_t pagesize = mem_pagesize();
+    uintptr_t lo = (uintptr_t) addr / pagesize * pagesize;
+    uintptr_t hi = ((uintptr_t) addr + len + pagesize - 1) / pagesize * pagesize;
+    size_t pages = 0;
+
+    while (lo < hi) {
+        size_t n = (hi - lo) / pagesize;
+        if (n > sizeof(vec))
+            n = sizeof(vec);
+        if (mincore((void *) lo, n * pagesize, vec) == 0) {
+            size_t i;
+            for (i = 0; i < n; i++)
+                pages += vec[i] & 1;
+        }
+        lo += n * pagesize;
+    }
+    return pages * pagesize;
+}
+
+/* Fold the resident bytes into their peak; map_lock must be held */
+static void note_resident(mem_heap_t *h) {
+    size_t bytes = resident_bytes(h);
+    if (bytes > h->peak_resident)
+        h->peak_resident = bytes;
+}
+
+/* Find the record of the mapping starting at addr; map_lock must be held */
+static mapping_t *find_mapping(mem_heap_t *h, void *addr) {
+    size_t i;
+    for (i = 0; i < h->num_mappings; i++) {
+        if (h->mappings[i].addr == addr)
+            return &h->mappings[i];
+    }
+    return NULL;
+}
+
 
-static void print_stats() {
-    size_t vbytes = mem_heapsize();
-    if (!show_stats || vbytes == 0 || stats_printed)
+static void print_stats(mem_heap_t *h) {
+    size_t vbytes = mem_heap_size(h);
+    if (!show_stats || vbytes == 0 || h->stats_printed)
         return;
     printf("Allocated %zu heap bytes.  Max address = %p\n",
-           vbytes, mem_brk);
-    stats_printed = true;
+           vbytes, h->mem_brk);
+    h->stats_printed = true;
 }
 
 uint64_t mem_read(const void *addr, size_t len) {
@@ -2,15 +2,94 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-void mem_init();               
+/*
+ * A simulated heap. Every heap has a reservation of its own and its own
+ * mappings; the functions below without a handle work on the default
+ * heap, the one mem_init sets up.
+ */
+typedef struct mem_heap mem_heap_t;
+
+/* Set up the default heap, empty; a sparse one reserves address space only */
+void mem_init(bool sparse_mode);
+
+/* Set up another empty heap, or return NULL; mem_heap_destroy frees it */
+mem_heap_t *mem_heap_create(bool sparse_mode);
+void mem_heap_destroy(mem_heap_t *h);
+
+/* The heap of mem_init */
+mem_heap_t *mem_default_heap(void);
+
+/*
+ * Take the dense heaps set up from now on from the named provider:
+ * "zero" (the default), "anon", "memfd", "file" or "populate". Returns
+ * false for an unknown name.
+ */
+bool mem_set_provider(const char *name);
+
+/* Name of provider i, or NULL past the last one */
+const char *mem_provider_name(int i);
+
+/* Back the dense heaps set up from now on with huge pages */
+void mem_set_huge_pages(bool on);
+
+/* What backs the current heap: "4K pages", "THP" or "hugetlb" */
+const char *mem_page_backing(void);
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+
+/* Heap bytes from this address on, never below the break, read as zero */
+void *mem_zero_lo(void);
 size_t mem_pagesize(void);
 
+/* Print why a failed request failed to stderr (the default), or not */
+void mem_report_errors(bool on);
+
+/* Page-granular mappings outside the heap, for very large blocks */
+void *mem_map(size_t size);
+void *mem_remap(void *addr, size_t old_size, size_t new_size);
+void mem_unmap(void *addr, size_t size);
+size_t mem_mapped_bytes(void);
+bool mem_in_mapping(const void *addr, size_t len);
+
+/* Largest heap size plus mapped bytes seen since the last reset */
+size_t mem_peak_size(void);
+
+/* Drop the pages above the break, so they are neither resident nor dirty */
+void mem_purge(void);
+
+/* Bytes of the heap and the mappings that are resident in memory */
+size_t mem_resident_bytes(void);
+
+/* Track the most resident bytes from now on, or stop tracking them */
+void mem_track_resident(bool on);
+
+/* Most resident bytes since tracking began, counting the present */
+size_t mem_peak_resident(void);
+
+/* The same on a given heap; first and last are its lo and hi */
+const char *mem_heap_page_backing(mem_heap_t *h);
+void mem_heap_deinit(mem_heap_t *h);
+void *mem_heap_sbrk(mem_heap_t *h, intptr_t incr);
+void mem_heap_reset_brk(mem_heap_t *h);
+void *mem_heap_first(mem_heap_t *h);
+void *mem_heap_last(mem_heap_t *h);
+size_t mem_heap_size(mem_heap_t *h);
+void *mem_heap_zero_lo(mem_heap_t *h);
+void *mem_heap_map(mem_heap_t *h, size_t size);
+void *mem_heap_remap(mem_heap_t *h, void *addr, size_t old_size, size_t new_size);
+void mem_heap_unmap(mem_heap_t *h, void *addr, size_t size);
+size_t mem_heap_mapped_bytes(mem_heap_t *h);
+bool mem_heap_in_mapping(mem_heap_t *h, const void *addr, size_t len);
+size_t mem_heap_peak_size(mem_heap_t *h);
+void mem_heap_purge(mem_heap_t *h);
+size_t mem_heap_resident_bytes(mem_heap_t *h);
+void mem_heap_track_resident(mem_heap_t *h, bool on);
+size_t mem_heap_peak_resident(mem_heap_t *h);
+
 /* Read len bytes and return value zero-extended to 64 bits */
 /* Require 0 <= len <= 8 */
 uint64_t mem_read(const void *addr, size_t len);
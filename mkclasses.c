@@ -0,0 +1,279 @@
+/*
+ * mkclasses.c - Generates sizeclass.h, the free list classes that mm.c
+ *     files blocks below CLASS_TABLE_LIMIT bytes under.
+ *
+ * Usage: mkclasses [-l <limit>] <trace.rep>... > sizeclass.h
+ *
+ * Every allocating request of the traces (a, r, m, and A once per block)
+ * is turned into the block size mm.c would ask for, and counted. The
+ * first-level classes of mm.c below the limit are then cut into
+ * SL_INDEX_COUNT classes each, with boundaries chosen to minimize the
+ * bytes by which requests are rounded up: a request that falls on a
+ * class boundary is served from the head of its own class, and any
+ * other from the head of the next class up, so it is rounded up to the
+ * next boundary. The cut is an exact dynamic program over the 16-byte
+ * sizes. A small uniform share of the weight keeps sizes the traces
+ * never ask for from being squeezed into one wide class.
+ *
+ * The header holds the class lower bounds and a table from size / 16 to
+ * class, so that mm.c classifies a small size with one load.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define ALIGN 16                /* block sizes are multiples of this */
+#define HEADER 8                /* bytes of a block before its payload */
+#define SL_INDEX_COUNT 8        /* classes per first-level class in mm.c */
+#define SMALL_BLOCK_SIZE 128    /* where mm.c's first level starts doubling */
+#define DEFAULT_LIMIT 1024
+#define MAX_LIMIT 4096          /* mm.c files bigger blocks in a tree */
+#define PRIOR_SHARE 0.01        /* weight spread evenly over all sizes */
+
+#define SLOTS (MAX_LIMIT / ALIGN)
+#define MAXLINE 1024
+
+static double weight[SLOTS];    /* requests by block size / ALIGN */
+static double sum[SLOTS + 1];   /* weight of the slots below i ... */
+static double moment[SLOTS + 1];/* ... and the sum of their slot * weight */
+static double requests;         /* all requests counted */
+static double small_requests;   /* those below the limit */
+
+static void count_trace(const char *path, size_t limit);
+static void count_request(size_t bytes, double n, size_t limit);
+static double segment_cost(int lo, int hi);
+static double table_cost(const int *bounds, int count, int slots);
+static void usage(const char *prog);
+
+int main(int argc, char **argv)
+{
+    size_t limit = DEFAULT_LIMIT;
+    int c, i, k;
+
+    while ((c = getopt(argc, argv, "l:h")) != -1) {
+        switch (c) {
+        case 'l':
+            limit = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (limit < 2 * SMALL_BLOCK_SIZE || limit > MAX_LIMIT
+        || (limit & (limit - 1)) != 0) {
+        fprintf(stderr, "%s: the limit must be a power of two from %d to %d\n",
+                argv[0], 2 * SMALL_BLOCK_SIZE, MAX_LIMIT);
+        exit(1);
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        exit(1);
+    }
+    for (i = optind; i < argc; i++) {
+        count_trace(argv[i], limit);
+    }
+
+    /* One first-level class below SMALL_BLOCK_SIZE, one per doubling after */
+    int slots = (int)(limit / ALIGN);
+    int count = SL_INDEX_COUNT;
+    for (size_t range = SMALL_BLOCK_SIZE; range < limit; range *= 2) {
+        count += SL_INDEX_COUNT;
+    }
+
+    /* Blocks are at least ALIGN bytes, so slot 0 never holds one */
+    double prior = small_requests > 0 ? small_requests * PRIOR_SHARE : 1.0;
+    for (i = 1; i < slots; i++) {
+        weight[i] += prior / (slots - 1);
+    }
+    for (i = 0; i < slots; i++) {
+        sum[i + 1] = sum[i] + weight[i];
+        moment[i + 1] = moment[i] + weight[i] * i;
+    }
+
+    /*
+     * cost[k][j]: least rounding of the sizes below slot j when k classes
+     * cover them and slot j starts the next one; from[k][j] is where the
+     * last of those k classes starts. Class 0 starts at slot 0.
+     */
+    double (*cost)[SLOTS + 1] = calloc(count + 1, sizeof(*cost));
+    int (*from)[SLOTS + 1] = calloc(count + 1, sizeof(*from));
+    if (cost == NULL || from == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        exit(1);
+    }
+    for (int j = 0; j <= slots; j++) {
+        cost[1][j] = j > 0 ? segment_cost(0, j) : INFINITY;
+    }
+    for (k = 2; k <= count; k++) {
+        for (int j = 0; j <= slots; j++) {
+            cost[k][j] = INFINITY;
+            for (int m = k - 1; m < j; m++) {
+                double total = cost[k - 1][m] + segment_cost(m, j);
+                if (total < cost[k][j]) {
+                    cost[k][j] = total;
+                    from[k][j] = m;
+                }
+            }
+        }
+    }
+
+    int bounds[SLOTS];
+    int j = slots;
+    for (k = count; k > 0; k--) {
+        j = k > 1 ? from[k][j] : 0;
+        bounds[k - 1] = j;
+    }
+
+    /* What mm.c's plain two-level classes would round by, for comparison */
+    int tlsf[SLOTS];
+    for (k = 0; k < SL_INDEX_COUNT; k++) {
+        tlsf[k] = k;
+    }
+    for (size_t range = SMALL_BLOCK_SIZE; range < limit; range *= 2) {
+        for (i = 0; i < SL_INDEX_COUNT; i++) {
+            tlsf[k++] = (int)((range + i * (range / SL_INDEX_COUNT)) / ALIGN);
+        }
+    }
+    fprintf(stderr, "%.0f requests, %.0f below %zu bytes; mean rounding "
+            "%.2f bytes with two-level classes, %.2f with these\n",
+            requests, small_requests, limit,
+            table_cost(tlsf, count, slots) / (small_requests + prior),
+            table_cost(bounds, count, slots) / (small_requests + prior));
+
+    printf("/*\n"
+           " * sizeclass.h - Free list classes for blocks below\n"
+           " *     CLASS_TABLE_LIMIT bytes, fitted to the request sizes of:\n");
+    for (i = optind; i < argc; i++) {
+        printf(" *         %s\n", argv[i]);
+    }
+    printf(" *\n"
+           " * Generated by mkclasses; regenerate with make classes.\n"
+           " */\n\n");
+    printf("#define CLASS_TABLE_LIMIT %zu\n", limit);
+    printf("#define CLASS_TABLE_COUNT %d\n\n", count);
+
+    printf("/* Smallest block size of each class */\n");
+    printf("static const uint16_t class_bounds[CLASS_TABLE_COUNT] = {");
+    for (k = 0; k < count; k++) {
+        printf("%s%d%s", k % 8 == 0 ? "\n    " : " ", bounds[k] * ALIGN,
+               k + 1 < count ? "," : "\n");
+    }
+    printf("};\n\n");
+
+    printf("/* Class of each block size / ALIGN_SIZE */\n");
+    printf("static const uint8_t class_index[CLASS_TABLE_LIMIT >> 4] = {");
+    for (i = 0, k = 0; i < slots; i++) {
+        while (k + 1 < count && bounds[k + 1] <= i) {
+            k++;
+        }
+        printf("%s%d%s", i % 16 == 0 ? "\n    " : " ", k,
+               i + 1 < slots ? "," : "\n");
+    }
+    printf("};\n");
+
+    free(cost);
+    free(from);
+    return 0;
+}
+
+/*
+ * count_trace - counts the allocating requests of one trace file
+ */
+static void count_trace(const char *path, size_t limit)
+{
+    char line[MAXLINE];
+    int header = 0;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "mkclasses: could not open %s\n", path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long id, n, a, bytes;
+        if (header < 4) {       /* weight, ids, ops and peak bytes */
+            header++;
+            continue;
+        }
+        switch (line[0]) {
+        case 'a':
+        case 'r':
+            if (sscanf(line + 1, "%lu %lu", &id, &bytes) == 2) {
+                count_request(bytes, 1, limit);
+            }
+            break;
+        case 'm':
+            if (sscanf(line + 1, "%lu %lu %lu", &id, &a, &bytes) == 3) {
+                count_request(bytes, 1, limit);
+            }
+            break;
+        case 'A':
+            if (sscanf(line + 1, "%lu %lu %lu", &id, &n, &bytes) == 3) {
+                count_request(bytes, (double)n, limit);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * count_request - counts n requests of bytes by the block size they need
+ */
+static void count_request(size_t bytes, double n, size_t limit)
+{
+    size_t asize = (bytes + HEADER + ALIGN - 1) / ALIGN * ALIGN;
+    if (asize < ALIGN) {
+        asize = ALIGN;
+    }
+    requests += n;
+    if (asize < limit) {
+        weight[asize / ALIGN] += n;
+        small_requests += n;
+    }
+}
+
+/*
+ * segment_cost - rounding of the sizes in a class from slot lo up to
+ *     slot hi: all but the class's own lower bound are rounded up to hi.
+ */
+static double segment_cost(int lo, int hi)
+{
+    if (hi <= lo + 1) {
+        return 0;
+    }
+    double w = sum[hi] - sum[lo + 1];
+    double m = moment[hi] - moment[lo + 1];
+    return (hi * w - m) * ALIGN;
+}
+
+/*
+ * table_cost - rounding of all sizes below slots under the given lower
+ *     bounds, the last class reaching up to slots
+ */
+static double table_cost(const int *bounds, int count, int slots)
+{
+    double total = 0;
+    for (int k = 0; k < count; k++) {
+        total += segment_cost(bounds[k], k + 1 < count ? bounds[k + 1] : slots);
+    }
+    return total;
+}
+
+/*
+ * usage - explains the command line
+ */
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-l <limit>] <trace.rep>... > sizeclass.h\n", prog);
+    fprintf(stderr, "\t-l <limit>  Fit the classes of block sizes below <limit>,\n");
+    fprintf(stderr, "\t            a power of two (default %d).\n", DEFAULT_LIMIT);
+}
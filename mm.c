@@ -1,20 +1,30 @@
 /*
  ******************************************************************************
  *                               mm.c                                         *
- *           64-bit struct-based implicit free list memory allocator          *
- *                      without coalesce functionality                        *
+ *          64-bit two-level segregated fit allocator with arenas             *
  *                 CSE 361: Introduction to Computer Systems                  *
  *                                                                            *
  *  ************************************************************************  *
- *                     insert your documentation here. :)                     *
+ *  Blocks carry a one-word header with their size and alloc, prev_alloc      *
+ *  and prev_mini bits. Only free blocks have a footer; free mini blocks of   *
+ *  16 bytes have none and keep their back link in the header instead.        *
  *                                                                            *
- *  ************************************************************************  *
- *  ** ADVICE FOR STUDENTS. **                                                *
- *  Step 0: Please read the writeup!                                          *
- *  Step 1: Write your heap checker. Write. Heap. checker.                    *
- *  Step 2: Place your contracts / debugging assert statements.               *
- *  Good luck, and have fun!                                                  *
+ *  Each arena owns segments of the heap and its free blocks:                 *
+ *   - blocks below TREE_MIN_SIZE sit on two-level segregated (TLSF) lists,   *
+ *     whose smallest classes come from sizeclass.h, with bitmaps to find     *
+ *     the first usable class; mm_set_policy picks how a block is chosen;     *
+ *   - bigger ones sit in a red-black tree by size and address, which gives   *
+ *     the exact best fit.                                                    *
+ *  Free blocks are coalesced at once with their neighbours, unless           *
+ *  deferred coalescing parks small ones on quick lists.                      *
+ *                                                                            *
+ *  Threads bind to private arenas while there are any, and share the last    *
+ *  one under a lock after that. Blocks freed by another thread go back to    *
+ *  their arena's owner. Small blocks also pass through a per-thread cache,   *
+ *  and the smallest requests get slots in slab runs.                         *
  *                                                                            *
+ *  Requests of mmap_threshold bytes or more get a mapping of their own,      *
+ *  and a free tail of the heap beyond trim_threshold goes back to memlib.    *
  ******************************************************************************
  */
 
@@ -27,9 +37,13 @@
 #include <stddef.h>
 #include <assert.h>
 #include <stddef.h>
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "sizeclass.h"
 
 #ifdef DRIVER
 /* create aliases for driver tests */
@@ -61,17 +75,114 @@
 #define dbg_assert(...)
 #define dbg_ensures(...)
 #endif
-#define NUM_FREE_LISTS 10
+
+/*
+ * Two-level segregated fit index. The first level splits block sizes
+ * into power-of-two ranges; the second level splits each range into
+ * SL_INDEX_COUNT equally wide classes. Sizes below SMALL_BLOCK_SIZE all
+ * share first-level class 0 and are split linearly by ALIGN_SIZE.
+ * A bit is set in fl_bitmap / sl_bitmap for every non-empty class.
+ *
+ * Below CLASS_TABLE_LIMIT the classes are instead read from the tables
+ * in sizeclass.h, which mkclasses fits to the request sizes of a set of
+ * traces; class k of the table is (k / SL_INDEX_COUNT, k % SL_INDEX_COUNT),
+ * so the table takes the place of the first few first-level classes.
+ */
+#define SL_INDEX_COUNT_LOG2 3
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define ALIGN_SIZE_LOG2 4
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2)
+#define FL_INDEX_MAX 62
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 2)
+#define SMALL_BLOCK_SIZE ((size_t)1 << FL_INDEX_SHIFT)
+
+#if CLASS_TABLE_COUNT % SL_INDEX_COUNT != 0 || CLASS_TABLE_LIMIT \
+    != 1 << (FL_INDEX_SHIFT + CLASS_TABLE_COUNT / SL_INDEX_COUNT - 1)
+#error "sizeclass.h does not cover whole first-level classes; rerun make classes"
+#endif
+
+/*
+ * Free blocks of TREE_MIN_SIZE bytes or more stay off the segregated
+ * lists; each arena keeps them in a red-black tree ordered by size and
+ * then address, which yields the exact best fit in logarithmic time.
+ */
+#define TREE_MIN_SIZE 4096
+
+/*
+ * Arenas. The last arena is shared, under a lock, by every thread that
+ * arrives once all the private ones are taken.
+ */
+#define NUM_ARENAS 16
+#define MAX_SEGMENTS 4096
+
+/*
+ * Per-thread caches of freed small blocks, one bin per block size up to
+ * TCACHE_MAX_SIZE. A bin holds up to TCACHE_BIN_COUNT blocks and moves
+ * TCACHE_BATCH of them at a time to or from its arena.
+ */
+#define TCACHE_MAX_SIZE 256
+#define TCACHE_BINS (TCACHE_MAX_SIZE / 16)
+#define TCACHE_BIN_COUNT 8
+#define TCACHE_BATCH 4
+
+/*
+ * Quick lists for deferred coalescing: one exact-size list per block
+ * size up to QUICK_MAX_SIZE.
+ */
+#define QUICK_MAX_SIZE 512
+#define QUICK_BINS (QUICK_MAX_SIZE / 16)
+
+/*
+ * Slab runs for small requests: one run per RUN_SIZE page of heap, with
+ * one class of slots per dsize step up to SLAB_MAX_SIZE. RUN_MAP_PAGES
+ * bounds the heap pages that can hold runs.
+ */
+#define RUN_SIZE 4096
+#define SLAB_MAX_SIZE 128
+#define SLAB_CLASSES (SLAB_MAX_SIZE / 16)
+#define RUN_BITMAP_WORDS 4
+#define RUN_MAP_PAGES (1 << 16)
+
+/*
+ * Event counters for mm_get_stats. Build with -DMM_STATS=1 to keep them;
+ * otherwise every stat_add compiles away.
+ */
+#ifndef MM_STATS
+#define MM_STATS 0
+#endif
 
 /* Basic constants */
 typedef uint64_t word_t;
 static const size_t wsize = sizeof(word_t);   // word and header size (bytes)
 static const size_t dsize = 2*sizeof(word_t);       // double word size (bytes)
-static const size_t min_block_size = 4*sizeof(word_t); // Minimum block size
+static const size_t mini_block_size = 2*sizeof(word_t); // Header plus one word
 static const size_t chunksize = (1 << 12);    // requires (chunksize % 16 == 0)
+static const size_t segment_size = (1 << 16); // Minimum new segment once several arenas grow
+static const size_t default_mmap_threshold = (1 << 20); // Requests this big get their own mapping
+static const size_t default_trim_threshold = (1 << 17); // Free tails bigger than this are released
+static const size_t default_slab_max = 32; // Requests this small go to slab runs
+static const int default_fit_cap = 12; // Blocks a capped best fit scan looks at
 
 static const word_t alloc_mask = 0x1;
+static const word_t prev_alloc_mask = 0x2; // Set when the previous block is allocated
+static const word_t prev_mini_mask = 0x4;  // Set when the previous block is a mini block
+static const word_t mini_free_mask = 0x8;  // Listed free mini block; see below
 static const word_t size_mask = ~(word_t)0xF;
+static const word_t zeroed_mask = 0x2;     // In footers: body known to be zero
+static const size_t link_words = 4;        // Payload words a free block may use
+/*
+ * Free mini blocks have room for the next_free pointer only and carry no
+ * footer, so the block after them records their size through its
+ * prev_mini bit instead. While a mini block sits on the mini list its
+ * size is implied by mini_free_mask, and the size bits of its header
+ * hold the prev_free link instead, keeping removal constant time.
+ *
+ * A free block whose footer carries zeroed_mask is zero throughout,
+ * except for its header, the first link_words of its payload (the list
+ * links or tree node) and the footer itself. Such blocks come fresh from
+ * mem_sbrk and keep the mark through splitting and through merging with
+ * one another, so calloc can skip clearing them.
+ */
 typedef struct block {
     word_t header;
     union{
@@ -80,32 +191,232 @@ typedef struct block {
             struct block *prev_free;
         };
       // Pointer to previous free block
+        struct{
+            struct block *child[2];   // Tree children: smaller, larger
+            struct block *parent;
+            bool red;
+        };
+      // Tree node of a free block of at least TREE_MIN_SIZE bytes
     char payload[0];
     };          // Flexible array member for the payload
 } block_t;
 
 
 
+/*
+ * A slab run is an allocated block of RUN_SIZE bytes whose payload starts
+ * a RUN_SIZE-aligned page; consecutive runs thus tile the heap, each one
+ * holding the header of the next in the last word of its page. The run
+ * header is followed by equal slots that carry no header of their own.
+ * A bit is set in bitmap for every free slot, and runs with free slots
+ * sit on their arena's list for their slot size.
+ */
+typedef struct run {
+    struct run *next;
+    struct run *prev;
+    struct arena *arena;
+    uint32_t slot_size;
+    uint32_t num_slots;
+    uint32_t free_slots;
+    word_t bitmap[RUN_BITMAP_WORDS];
+} run_t;
+
+/*
+ * An arena owns its own free lists and heap segments. A thread is bound
+ * to a private arena on first use and works on it without locking.
+ * Blocks it frees into another private arena are pushed onto that
+ * arena's remote_free stack and reclaimed by its owner on the next call.
+ */
+typedef struct arena {
+    /* Segregated free list heads, indexed by [first level][second level] */
+    block_t *free_list_heads[FL_INDEX_COUNT][SL_INDEX_COUNT];
+    /* One bit per non-empty first-level class */
+    word_t fl_bitmap;
+    /* One bit per non-empty second-level class, for each first level */
+    uint32_t sl_bitmap[FL_INDEX_COUNT];
+    /* Singly linked list of free mini blocks */
+    block_t *mini_free_list;
+    /* Root of the tree of free blocks too big for the lists */
+    block_t *tree_root;
+    /* Where the next fit policy resumes; a listed block or NULL */
+    block_t *rover;
+    /* Slab runs with free slots, by slot size */
+    run_t *runs[SLAB_CLASSES];
+    /* Freed but not yet coalesced blocks, by size; still marked allocated */
+    block_t *quick_lists[QUICK_BINS];
+    bool quick_pending;
+    /* Epilogue of the segment this arena extended last */
+    block_t *epilogue;
+    /* Blocks freed by other threads, linked through next_free */
+    block_t *remote_free;
+    /* Generation the lists were last reset in */
+    unsigned generation;
+    /* Generation of the thread bound to this arena; stale if unowned */
+    unsigned owner_generation;
+    /* Shared arenas are used by many threads under shared_lock */
+    bool shared;
+} arena_t;
+
+/*
+ * A segment is a contiguous stretch of heap between a prologue and an
+ * epilogue, owned by one arena. Segments are created in address order,
+ * so a block belongs to the last segment starting below it.
+ */
+typedef struct {
+    char *lo;
+    arena_t *arena;
+} segment_t;
+
+/*
+ * A thread's cache of recently freed small blocks of its own arena.
+ * Cached blocks stay marked allocated, so caching or reusing one touches
+ * neither its neighbours nor the free lists. Bin i holds blocks of
+ * (i + 1) * dsize bytes, linked through next_free.
+ */
+typedef struct {
+    block_t *bins[TCACHE_BINS];
+    unsigned counts[TCACHE_BINS];
+    /* Generation the bins were filled in; stale bins are dropped */
+    unsigned generation;
+    /* Small requests seen, and those served from the bins */
+    size_t lookups;
+    size_t hits;
+} tcache_t;
+
 /* Global variables */
+static arena_t arenas[NUM_ARENAS];
+static segment_t segments[MAX_SEGMENTS];
+static size_t num_segments;
+/* Set once an arena other than the first may own blocks */
+static bool multi_arena;
+/* Bumped by mm_init, invalidating every arena binding */
+static unsigned arena_generation;
+/* Serializes mem_sbrk and the segment table */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Releases a thread's private arena when the thread exits */
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+static __thread arena_t *thread_arena;
+static __thread unsigned thread_generation;
+static __thread tcache_t tcache;
+/* Set to defer coalescing of small blocks until a fit fails */
+static bool deferred_coalescing;
+/* Requests of at least this many bytes are served by mem_map */
+static size_t mmap_threshold = default_mmap_threshold;
+/* A free block bigger than this at the break is given back to memlib */
+static size_t trim_threshold = default_trim_threshold;
+/* Requests of up to this many bytes are served from slab runs */
+static size_t slab_max = default_slab_max;
+/* Placement policy for the segregated lists, and its scan cap */
+static mm_policy_t fit_policy = MM_FIT_GOOD;
+static int fit_cap = default_fit_cap;
+/* One byte per RUN_SIZE page of heap, set while the page holds a run */
+static unsigned char run_map[RUN_MAP_PAGES];
+static char *run_map_base;
+/* Pages from here on have never held a run */
+static size_t run_map_top;
+/* Cache counters of threads that exited in this generation */
+static size_t tcache_lookups;
+static size_t tcache_hits;
+/* Event counters since mm_init, kept if MM_STATS is set */
+static mm_stats_t stats;
 /* Pointer to first block */
-static block_t *free_list_heads[NUM_FREE_LISTS];
 static block_t *heap_start = NULL;
 
 bool mm_checkheap(int lineno);
 
 /* Function prototypes for internal helper routines */
-static int get_free_list_index(size_t size);
-
-static block_t *extend_heap(size_t size);
-static void place(block_t *block, size_t asize);
-static block_t *find_fit(size_t asize);
-static block_t *coalesce(block_t *block);
-
-static void add_to_free_list(block_t *block); //added for modularity
-static void remove_from_free_list(block_t *block);
+static void mapping_insert(size_t size, int *fl, int *sl);
+static void mapping_search(size_t size, int *fl, int *sl);
+static block_t *find_suitable_block(arena_t *arena, int *fl, int *sl);
+
+static block_t *extend_heap(arena_t *arena, size_t size);
+static void place(arena_t *arena, block_t *block, size_t asize);
+static block_t *find_fit(arena_t *arena, size_t asize);
+static block_t *search_fit(arena_t *arena, size_t asize, size_t *steps);
+static block_t *policy_fit(arena_t *arena, size_t asize, size_t *steps);
+static block_t *scan_class(block_t *head, block_t *start, size_t asize,
+                           int cap, bool best, size_t *steps);
+static void record_fit(size_t asize, block_t *block, size_t steps);
+static block_t *coalesce(arena_t *arena, block_t *block);
+static void absorb_next(arena_t *arena, block_t *block);
+static void shrink_block(arena_t *arena, block_t *block, size_t asize);
+static void trim_heap(arena_t *arena, block_t *block);
+static void *allocate(size_t size, bool *zeroed);
+static void *arena_malloc(arena_t *arena, size_t asize, bool *zeroed);
+static void *arena_memalign(arena_t *arena, size_t align, size_t asize);
+static block_t *extend_aligned(arena_t *arena, size_t align, size_t asize);
+static size_t aligned_gap(block_t *block, size_t align);
+static void deallocate(void *bp);
+static void release(void *bp, arena_t *arena);
+static void arena_free(arena_t *arena, void *bp);
+static size_t split_batch(block_t *block, size_t asize, size_t count,
+                          void **out);
+static int compare_addresses(const void *a, const void *b);
+static void free_block(arena_t *arena, block_t *block);
+static void *resize_in_place(arena_t *arena, block_t *block, size_t asize);
+
+static void arena_reset(arena_t *arena);
+static arena_t *arena_bind(void);
+static void arena_unbind(void *arg);
+static void arena_key_create(void);
+static arena_t *arena_acquire(void);
+static void arena_release(arena_t *arena);
+static arena_t *arena_of(block_t *block);
+static void remote_free(arena_t *arena, block_t *block);
+static void reclaim_remote_frees(arena_t *arena);
+
+static bool tcache_valid(void);
+static void *tcache_get(size_t asize);
+static bool tcache_put(block_t *block, size_t size);
+static void tcache_refill(arena_t *arena, size_t asize);
+static void tcache_flush(arena_t *arena, int bin, unsigned count);
+static bool tcache_drain(arena_t *arena);
+static bool check_tcache(int line);
+
+static block_t *map_block(size_t asize, size_t align);
+static size_t mapped_offset(block_t *block);
+static void unmap_block(block_t *block);
+static block_t *remap_block(block_t *block, size_t asize);
+static bool is_mapped(block_t *block);
+static void stat_add(size_t *counter, size_t n);
+
+static block_t *quick_get(arena_t *arena, size_t asize);
+static bool consolidate(arena_t *arena);
+static bool drain_caches(arena_t *arena);
+
+static run_t *run_of(void *bp);
+static run_t *run_create(arena_t *arena, size_t slot_size);
+static void *run_malloc(arena_t *arena, size_t slot_size);
+static void run_free(run_t *run, void *bp);
+static void run_destroy(run_t *run);
+static bool run_drain(arena_t *arena);
+static void run_link(run_t *run);
+static void run_unlink(run_t *run);
+static bool check_runs(arena_t *arena, int line);
+
+static bool check_block(block_t *block, int line);
+static bool check_arena(arena_t *arena, int line);
+
+static void add_to_free_list(arena_t *arena, block_t *block); //added for modularity
+static void remove_from_free_list(arena_t *arena, block_t *block);
+
+static bool tree_before(block_t *a, block_t *b);
+static bool tree_red(block_t *node);
+static void tree_rotate(arena_t *arena, block_t *node, int dir);
+static void tree_replace(arena_t *arena, block_t *node, block_t *with);
+static void tree_insert(arena_t *arena, block_t *block);
+static void tree_remove(arena_t *arena, block_t *block);
+static void tree_fix_removal(arena_t *arena, block_t *node, block_t *parent);
+static block_t *tree_best_fit(arena_t *arena, size_t asize, size_t *steps);
+static block_t *tree_aligned_fit(block_t *node, size_t align, size_t asize,
+                                 size_t limit);
+static int check_tree(arena_t *arena, block_t *node, block_t *lo,
+                      block_t *hi, int line);
 static size_t max(size_t x, size_t y);
 static size_t round_up(size_t size, size_t n);
-static word_t pack(size_t size, bool alloc);
+static word_t pack(size_t size, bool alloc, bool prev_alloc, bool prev_mini);
 
 static size_t extract_size(word_t header);
 static size_t get_size(block_t *block);
@@ -113,9 +424,22 @@ static size_t get_payload_size(block_t *block);
 
 static bool extract_alloc(word_t header);
 static bool get_alloc(block_t *block);
-
-static void write_header(block_t *block, size_t size, bool alloc);
+static bool extract_prev_alloc(word_t header);
+static bool get_prev_alloc(block_t *block);
+static void set_prev_alloc(block_t *block, bool prev_alloc);
+static bool extract_prev_mini(word_t header);
+static bool get_prev_mini(block_t *block);
+static void set_prev_mini(block_t *block, bool prev_mini);
+static block_t *get_mini_prev(block_t *block);
+static void set_mini_prev(block_t *block, block_t *prev);
+
+static void write_header(block_t *block, size_t size, bool alloc,
+                         bool prev_alloc, bool prev_mini);
 static void write_footer(block_t *block, size_t size, bool alloc);
+static bool get_zeroed(block_t *block);
+static void set_zeroed(block_t *block, bool zeroed);
+static void clear_free_words(block_t *block);
+static void erase_tags(block_t *block);
 
 static block_t *payload_to_header(void *bp);
 static void *header_to_payload(block_t *block);
@@ -124,33 +448,37 @@ static block_t *find_next(block_t *block);
 static word_t *find_prev_footer(block_t *block);
 static block_t *find_prev(block_t *block);
 /*
- * <what does mm_init do?>
+ * mm_init - sets up an empty heap and returns whether it could. Drops
+ * every arena binding and gives the first arena a fresh heap; the other
+ * arenas are reset lazily when a thread binds to them. Must not run
+ * concurrently with any other allocator call.
  */
 bool mm_init(void) 
 {
-    // Initialize all segregated free list heads to NULL
-    int i;
-    for (i = 0; i < NUM_FREE_LISTS; i++) {
-        free_list_heads[i] = NULL;
-    }
-
-    // Create the initial empty heap 
-    word_t *start = (word_t *)(mem_sbrk(2 * wsize));
-    dbg_printf("Heap start: %p\n", start);
-    if (start == (void *)-1) {
-        return false;
-    }
-
-    start[0] = pack(0, true); // Prologue header
-    start[1] = pack(0, true); // Prologue footer
-    heap_start = (block_t *) &(start[1]);
-
-    // Extend the empty heap with a free block of chunksize bytes
-    block_t *initial_block = extend_heap(chunksize);
+    // A new generation makes every arena unowned and due for a reset,
+    // and every thread cache stale
+    arena_generation++;
+    tcache_lookups = 0;
+    tcache_hits = 0;
+    memset(&stats, 0, sizeof(stats));
+    num_segments = 0;
+    multi_arena = false;
+    arenas[NUM_ARENAS - 1].shared = true;
+    heap_start = NULL;
+    memset(run_map, 0, run_map_top);
+    run_map_top = 0;
+    run_map_base = (char *)((size_t)mem_heap_lo() & ~(size_t)(RUN_SIZE - 1));
+
+    // Create the initial heap segment with a free block of chunksize bytes
+    arena_t *arena = &arenas[0];
+    arena_reset(arena);
+    block_t *initial_block = extend_heap(arena, chunksize);
     dbg_printf("Initial block: %p, Size: %zu\n", initial_block, get_size(initial_block));
     if (initial_block == NULL) {
         return false;
     }
+    heap_start = (block_t *)((word_t *)mem_heap_lo() + 1);
+    dbg_printf("Heap start: %p\n", heap_start);
 
     // Check heap consistency
     dbg_printf("Checking heap after init...\n");
@@ -161,15 +489,26 @@ bool mm_init(void)
 
 
 /*
- * <what does mmalloc do?>
+ * malloc - allocates size bytes; see allocate.
+ */
+void *malloc(size_t size)
+{
+    stat_add(&stats.malloc_calls, 1);
+    return allocate(size, NULL);
+}
+
+/*
+ * allocate - serves malloc and calloc. Requests of up to slab_max bytes
+ *     get a slot in a slab run. Other small requests are served from
+ *     the thread cache when it has a block of the right size; a miss
+ *     refills the cache along the way. Requests of mmap_threshold bytes
+ *     or more get a mapping of their own. Unless zeroed is NULL, it is
+ *     set to whether the payload is known to be all zero.
  */
  // CHECKED
-void *malloc(size_t size) 
+static void *allocate(size_t size, bool *zeroed)
 {
     dbg_requires(mm_checkheap(__LINE__));
-    size_t asize;      // Adjusted block size
-    size_t extendsize; // Amount to extend heap if no fit is found
-    block_t *block;
     void *bp = NULL;
 
     if (heap_start == NULL) { // Initialize heap if it isn't initialized
@@ -180,40 +519,241 @@ void *malloc(size_t size)
         dbg_ensures(mm_checkheap(__LINE__));
         return bp;
     }
+    if (size > SIZE_MAX / 2) { // No heap or mapping can hold this much
+        return NULL;
+    }
+
+    // Adjust block size to include the header and to meet alignment
+    // requirements; allocated blocks carry no footer
+    size_t asize = max(round_up(size + wsize, dsize), mini_block_size);
+
+    if (size >= mmap_threshold) {
+        block_t *block = map_block(asize, dsize);
+        if (zeroed != NULL) {
+            *zeroed = true;
+        }
+        return block == NULL ? NULL : header_to_payload(block);
+    }
 
-    // Adjust block size to include overhead and to meet alignment requirements
-    asize = round_up(size + dsize, dsize);
+    if (zeroed != NULL) {
+        *zeroed = false;
+    }
+    if (size <= slab_max) {
+        arena_t *arena = arena_acquire();
+        bp = run_malloc(arena, round_up(size, dsize));
+        arena_release(arena);
+        if (bp != NULL) {
+            dbg_ensures(mm_checkheap(__LINE__));
+            return bp;
+        }
+    }
+    if (asize <= TCACHE_MAX_SIZE) {
+        bp = tcache_get(asize);
+        if (bp != NULL) {
+            dbg_ensures(mm_checkheap(__LINE__));
+            return bp;
+        }
+    }
+
+    arena_t *arena = arena_acquire();
+    bp = arena_malloc(arena, asize, zeroed);
+    if (bp != NULL && asize <= TCACHE_MAX_SIZE) {
+        tcache_refill(arena, asize);
+    }
+    arena_release(arena);
+
+    dbg_ensures(mm_checkheap(__LINE__));
+    return bp;
+} 
+
+/*
+ * arena_malloc - allocates a block of asize bytes from the given arena,
+ *                extending the heap if no free block fits. Unless zeroed
+ *                is NULL, a block taken from a known-zero free block has
+ *                its payload cleared of the free list words and *zeroed
+ *                is set.
+ */
+static void *arena_malloc(arena_t *arena, size_t asize, bool *zeroed)
+{
+    size_t extendsize; // Amount to extend heap if no fit is found
+    block_t *block;
+
+    // An exact fit left on a quick list needs no placing
+    if (arena->quick_pending && asize <= QUICK_MAX_SIZE) {
+        block = quick_get(arena, asize);
+        if (block != NULL) {
+            return header_to_payload(block);
+        }
+    }
 
-    // Search the free list for a fit
-    block = find_fit(asize);
+    // Search the free list for a fit; cached and deferred blocks may be
+    // pinning the space a fit needs, so merge them before growing the heap
+    block = find_fit(arena, asize);
+    if (block == NULL && drain_caches(arena)) {
+        block = find_fit(arena, asize);
+    }
 
     // If no fit is found, request more memory, and then and place the block
     if (block == NULL) {  
         extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
+        block = extend_heap(arena, extendsize);
         if (block == NULL) { // extend_heap returns an error
-            return bp;
+            return NULL;
         }
     }
     dbg_printf("Place: block address = %p, payload address = %p, size = %zu\n", 
         (void*)block, header_to_payload(block), asize);
-    place(block, asize);
-    
-    bp = header_to_payload(block);
+    bool known_zero = zeroed != NULL && get_zeroed(block);
+    place(arena, block, asize);
+    if (known_zero) {
+        clear_free_words(block);
+        *zeroed = true;
+    }
     dbg_printf("Malloc: block address = %p, payload address = %p, size = %zu\n", 
-        (void*)block, bp, asize);
-    dbg_requires(mm_checkheap(__LINE__));
-    return bp;
-} 
+        (void*)block, header_to_payload(block), asize);
+    return header_to_payload(block);
+}
+
+/*
+ * drain_caches - gives the blocks held by the thread cache, the quick lists
+ *                and empty slab runs back to the heap. Returns whether
+ *                there were any.
+ */
+static bool drain_caches(arena_t *arena)
+{
+    bool drained = tcache_drain(arena);
+    drained = run_drain(arena) || drained;
+    return consolidate(arena) || drained;
+}
+
+/*
+ * arena_memalign - allocates a block of asize bytes from the arena whose
+ *     payload is aligned to align, a power of two. The block is cut from the
+ *     smallest free block that happens to hold it, one big enough for any
+ *     alignment (draining the caches if need be), or else the end of the
+ *     heap; the space in front of the aligned payload, a multiple of dsize
+ *     and so big enough for a block, is freed again.
+ */
+static void *arena_memalign(arena_t *arena, size_t align, size_t asize)
+{
+    size_t size = asize + align - dsize;
+    block_t *block = NULL;
+    int pass;
+    for (pass = 0; block == NULL && pass < 2; pass++) {
+        if (pass == 1 && !drain_caches(arena)) {
+            break;
+        }
+        block = tree_aligned_fit(arena->tree_root, align, asize, size);
+        if (block == NULL) {
+            block = find_fit(arena, size);
+        }
+    }
+    if (block == NULL) {
+        block = extend_aligned(arena, align, asize);
+    }
+    if (block != NULL) {
+        place(arena, block, aligned_gap(block, align) + asize);
+    } else {
+        void *bp = arena_malloc(arena, size, NULL);
+        if (bp == NULL) {
+            return NULL;
+        }
+        block = payload_to_header(bp);
+    }
+
+    size_t gap = aligned_gap(block, align);
+    if (gap != 0) {
+        block_t *aligned = (block_t *)((char *)block + gap);
+        write_header(aligned, get_size(block) - gap, true, false,
+                     gap == mini_block_size);
+        set_prev_mini(find_next(aligned), get_size(aligned) == mini_block_size);
+        write_header(block, gap, false, get_prev_alloc(block),
+                     get_prev_mini(block));
+        write_footer(block, gap, false);
+        coalesce(arena, block);
+        block = aligned;
+    }
+    shrink_block(arena, block, asize);
+    return header_to_payload(block);
+}
+
+/*
+ * extend_aligned - grows the heap by only what an aligned block of asize
+ *     bytes needs beyond the free block at the arena's end. Returns the
+ *     free block that holds it, or NULL if the heap could not be grown
+ *     right behind the arena.
+ */
+static block_t *extend_aligned(arena_t *arena, size_t align, size_t asize)
+{
+    block_t *last = arena->epilogue;
+    if (last == NULL) {
+        return NULL;
+    }
+    if (!get_prev_alloc(last)) {
+        last = find_prev(last);
+    }
+    char *end = (char *)last + aligned_gap(last, align) + asize;
+    block_t *block = last;
+    if (end > (char *)arena->epilogue) {
+        block = extend_heap(arena, end - (char *)arena->epilogue);
+    }
+    if (block == NULL || get_size(block) < aligned_gap(block, align) + asize) {
+        return NULL;
+    }
+    return block;
+}
+
+/*
+ * aligned_gap - returns how far the payload of a block lies before the
+ *               next multiple of align.
+ */
+static size_t aligned_gap(block_t *block, size_t align)
+{
+    size_t bp = (size_t)header_to_payload(block);
+    return round_up(bp, align) - bp;
+}
 
 //DIDN'T-CHECK!
-static void remove_from_free_list(block_t *block) {
+static void remove_from_free_list(arena_t *arena, block_t *block) {
     size_t size = get_size(block);
-    int index = get_free_list_index(size);  // Use the same function to find the correct list
+    int fl, sl;
+
+    // Mini blocks keep their back link in the header; restore the size
+    if (size == mini_block_size) {
+        block_t *prev = get_mini_prev(block);
+        if (prev == NULL) {
+            arena->mini_free_list = block->next_free;
+        } else {
+            prev->next_free = block->next_free;
+        }
+        if (block->next_free != NULL) {
+            set_mini_prev(block->next_free, prev);
+        }
+        write_header(block, size, false, get_prev_alloc(block),
+                     get_prev_mini(block));
+        block->next_free = NULL;
+        return;
+    }
+    if (size >= TREE_MIN_SIZE) {
+        tree_remove(arena, block);
+        return;
+    }
+
+    mapping_insert(size, &fl, &sl);  // Use the same function to find the correct list
+    if (block == arena->rover) {
+        arena->rover = block->next_free;
+    }
 
     // If the block is the first in the list
     if (block->prev_free == NULL) {
-        free_list_heads[index] = block->next_free;
+        arena->free_list_heads[fl][sl] = block->next_free;
+        // Clear the class bits once the list runs empty
+        if (block->next_free == NULL) {
+            arena->sl_bitmap[fl] &= ~(1U << sl);
+            if (arena->sl_bitmap[fl] == 0) {
+                arena->fl_bitmap &= ~((word_t)1 << fl);
+            }
+        }
     } else {
         block->prev_free->next_free = block->next_free;
     }
@@ -229,25 +769,147 @@ static void remove_from_free_list(block_t *block) {
 }
 
 /*
- * <what does free do?>
+ * free - frees bp, unless it is NULL; see deallocate.
  */
 void free(void *bp)
 {
+    stat_add(&stats.free_calls, 1);
+    deallocate(bp);
+}
+
+/*
+ * deallocate - frees bp for free and the calls built on it. Small blocks
+ *     of the caller's own arena go to its thread cache, and mapped blocks
+ *     are unmapped. Other blocks and slab slots of its arena are freed
+ *     directly; those of another private arena are handed to its owner.
+ */
+static void deallocate(void *bp)
+{
+    if (bp == NULL) {
+        return;
+    }
+
+    run_t *run = run_of(bp);
+    if (run != NULL) {
+        release(bp, run->arena);
+        return;
+    }
+    block_t *block = payload_to_header(bp);
+    size_t size = get_size(block);
+    if (size <= TCACHE_MAX_SIZE) {
+        if (tcache_put(block, size)) {
+            return;
+        }
+    } else if (is_mapped(block)) {
+        unmap_block(block);
+        return;
+    }
+    release(bp, arena_of(block));
+}
+
+/*
+ * mm_free_sized - frees bp given the size it was last requested with.
+ *                 The cache bin comes from the caller's size instead of
+ *                 the header, which is only checked against it in debug
+ *                 builds. A size no block can have is left to free.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+    stat_add(&stats.free_sized_calls, 1);
     if (bp == NULL) {
         return;
     }
+    dbg_assert(size <= SIZE_MAX / 2);
+    if (size > SIZE_MAX / 2) { // asize below would wrap to a small bin
+        free(bp);
+        return;
+    }
 
+    run_t *run = run_of(bp);
+    if (run != NULL) {
+        dbg_assert(run->slot_size == round_up(size, dsize));
+        release(bp, run->arena);
+        return;
+    }
     block_t *block = payload_to_header(bp);
+    size_t asize = max(round_up(size + wsize, dsize), mini_block_size);
+    if (asize <= TCACHE_MAX_SIZE) {
+        dbg_assert(get_size(block) == asize);
+        if (tcache_put(block, asize)) {
+            return;
+        }
+    } else if (is_mapped(block)) {
+        unmap_block(block);
+        return;
+    } else {
+        dbg_assert(get_size(block) == asize);
+    }
+    release(bp, arena_of(block));
+}
+
+/*
+ * release - frees bp into arena, which owns it: under the shared lock,
+ *           directly from the owning thread, or through the owner's
+ *           remote free stack.
+ */
+static void release(void *bp, arena_t *arena)
+{
+    if (arena->shared) {
+        pthread_mutex_lock(&shared_lock);
+        arena_free(arena, bp);
+        pthread_mutex_unlock(&shared_lock);
+    } else if (arena == thread_arena && thread_generation == arena_generation) {
+        arena_free(arena, bp);
+    } else {
+        remote_free(arena, payload_to_header(bp));
+    }
+}
+
+/*
+ * arena_free - returns a block or slab slot to the arena it came from,
+ *              which the caller holds.
+ */
+static void arena_free(arena_t *arena, void *bp)
+{
+    run_t *run = run_of(bp);
+    if (run != NULL) {
+        run_free(run, bp);
+    } else {
+        free_block(arena, payload_to_header(bp));
+    }
+}
+
+/*
+ * free_block - marks an allocated block free and merges it into the
+ *              free lists of its arena. With deferred coalescing, small
+ *              blocks are only pushed onto their quick list.
+ */
+static void free_block(arena_t *arena, block_t *block)
+{
     size_t size = get_size(block);
 
-    write_header(block, size, false);
+    if (deferred_coalescing && size <= QUICK_MAX_SIZE) {
+        int bin = size / dsize - 1;
+        block->next_free = arena->quick_lists[bin];
+        arena->quick_lists[bin] = block;
+        arena->quick_pending = true;
+        return;
+    }
+
+    write_header(block, size, false, get_prev_alloc(block),
+                 get_prev_mini(block));
     write_footer(block, size, false);
-    coalesce(block);
+    trim_heap(arena, coalesce(arena, block));
 }
 
 
 /*
- * <what does realloc do?>
+ * realloc - resizes ptr to size bytes, keeping its contents up to the
+ * smaller of the two sizes. Slab slots stay put only at their own size.
+ * Heap blocks are resized in place whenever the block belongs to the
+ * caller's arena and its neighbours allow it. Mapped blocks that stay
+ * above mmap_threshold are remapped, and heap blocks growing past it move
+ * to a mapping. Only otherwise is the payload copied to a new block.
  */
 void *realloc(void *ptr, size_t size)
 {
@@ -255,21 +917,63 @@ void *realloc(void *ptr, size_t size)
     size_t copysize;
     void *newptr;
 
+    stat_add(&stats.realloc_calls, 1);
+
     // If size == 0, then free block and return NULL
     if (size == 0)
     {
-        free(ptr);
+        deallocate(ptr);
         return NULL;
     }
 
     // If ptr is NULL, then equivalent to malloc
     if (ptr == NULL)
     {
-        return malloc(size);
+        return allocate(size, NULL);
+    }
+
+    // No block can hold this much; the old one is left as it is
+    if (size > SIZE_MAX / 2)
+    {
+        return NULL;
+    }
+
+    size_t asize = max(round_up(size + wsize, dsize), mini_block_size);
+    run_t *run = run_of(ptr);
+    newptr = NULL;
+    if (run != NULL)
+    {
+        // A slot can only be kept at its own size
+        if (round_up(size, dsize) == run->slot_size)
+        {
+            return ptr;
+        }
+    }
+    else if (is_mapped(block))
+    {
+        if (size >= mmap_threshold)
+        {
+            block = remap_block(block, asize);
+            return block == NULL ? NULL : header_to_payload(block);
+        }
+    }
+    else if (size < mmap_threshold || asize <= get_size(block))
+    {
+        arena_t *arena = arena_acquire();
+        if (arena_of(block) == arena)
+        {
+            newptr = resize_in_place(arena, block, asize);
+        }
+        arena_release(arena);
+    }
+    if (newptr != NULL)
+    {
+        dbg_ensures(mm_checkheap(__LINE__));
+        return newptr;
     }
 
     // Otherwise, proceed with reallocation
-    newptr = malloc(size);
+    newptr = allocate(size, NULL);
     // If malloc fails, the original block is left untouched
     if (newptr == NULL)
     {
@@ -277,261 +981,2129 @@ void *realloc(void *ptr, size_t size)
     }
 
     // Copy the old data
-    copysize = get_payload_size(block); // gets size of old payload
+    copysize = run != NULL ? run->slot_size : get_payload_size(block); // gets size of old payload
     if(size < copysize)
     {
         copysize = size;
     }
     memcpy(newptr, ptr, copysize);
+    stat_add(&stats.realloc_copies, 1);
+    stat_add(&stats.realloc_copy_bytes, copysize);
 
     // Free the old block
-    free(ptr);
+    deallocate(ptr);
 
     return newptr;
 }
 
 /*
- * <what does calloc do?>
+ * resize_in_place - tries to resize an allocated block of the arena to
+ *     asize bytes without copying to a new block: a shrinking block
+ *     returns its tail, a growing block absorbs a free successor, slides
+ *     down into a free predecessor, or extends the heap when it is the
+ *     last block of the arena. Returns the (possibly moved) payload, or
+ *     NULL if none of these apply.
+ */
+static void *resize_in_place(arena_t *arena, block_t *block, size_t asize)
+{
+    void *ptr = header_to_payload(block);
+    size_t csize = get_size(block);
+
+    // Shrinking: keep the block and give back its tail
+    if (asize <= csize)
+    {
+        shrink_block(arena, block, asize);
+        return ptr;
+    }
+
+    block_t *next = find_next(block);
+    size_t next_free = get_alloc(next) ? 0 : get_size(next);
+
+    // Growing into a free successor
+    if (csize + next_free >= asize)
+    {
+        absorb_next(arena, block);
+        shrink_block(arena, block, asize);
+        return ptr;
+    }
+
+    // Growing into a free predecessor (and successor), moving the payload
+    if (!get_prev_alloc(block))
+    {
+        block_t *prev = find_prev(block);
+        size_t total = get_size(prev) + csize + next_free;
+        if (total >= asize)
+        {
+            size_t copysize = get_payload_size(block);
+            if (next_free != 0)
+            {
+                absorb_next(arena, block);
+            }
+            remove_from_free_list(arena, prev);
+            write_header(prev, total, true, get_prev_alloc(prev),
+                         get_prev_mini(prev));
+            memmove(header_to_payload(prev), ptr, copysize);
+            stat_add(&stats.realloc_copies, 1);
+            stat_add(&stats.realloc_copy_bytes, copysize);
+            set_prev_alloc(find_next(prev), true);
+            set_prev_mini(find_next(prev), false);
+            shrink_block(arena, prev, asize);
+            return header_to_payload(prev);
+        }
+    }
+
+    // Last block before the arena's epilogue: extend the heap by the
+    // shortfall, provided the new space lands right behind us
+    block_t *after = (next_free != 0) ? find_next(next) : next;
+    if (after == arena->epilogue)
+    {
+        block_t *grown = extend_heap(arena, asize - csize - next_free);
+        if (grown != NULL && grown == find_next(block))
+        {
+            absorb_next(arena, block);
+            shrink_block(arena, block, asize);
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * calloc - allocates elements items of size bytes each, all zero. Clears
+ * the payload only when it did not come from memory that is already known
+ * to be zero: fresh heap space or a mapping of its own.
  */
 void *calloc(size_t elements, size_t size)
 {
     void *bp;
     size_t asize = elements * size;
+    bool zeroed;
 
-    if (asize/elements != size)
+    stat_add(&stats.calloc_calls, 1);
+    if (elements != 0 && asize/elements != size)
     {    
         // Multiplication overflowed
         return NULL;
     }
     
-    bp = malloc(asize);
+    bp = allocate(asize, &zeroed);
     if (bp == NULL)
     {
         return NULL;
     }
     // Initialize all bits to 0
-    memset(bp, 0, asize);
+    if (!zeroed)
+    {
+        memset(bp, 0, asize);
+    }
 
     return bp;
 }
 
-/******** The remaining content below are helper and debug routines ********/
-
 /*
- * <what does extend_heap do?>
+ * mm_memalign - allocates size bytes whose payload is aligned to align, a
+ *     power of two. Alignments the heap gives anyway are left to malloc;
+ *     requests of mmap_threshold bytes or more get a mapping of their
+ *     own, aligned within it; other ones are cut from a heap block with
+ *     just enough slack, the misaligned front and the unused tail going
+ *     back to the free lists. Returns NULL if align is not a power of two.
  */
-static block_t *extend_heap(size_t size) 
+void *mm_memalign(size_t align, size_t size)
 {
-    void *bp;
-
-    // Allocate an even number of words to maintain alignment
-    size = round_up(size, dsize);
-    if ((bp = mem_sbrk(size)) == (void *)-1)
-    {
+    stat_add(&stats.memalign_calls, 1);
+    if (align == 0 || (align & (align - 1)) != 0) {
         return NULL;
     }
-    
-    // Initialize free block header/footer 
-    block_t *block = payload_to_header(bp);
-    write_header(block, size, false);
-    write_footer(block, size, false);
-    // Create new epilogue header
-    block_t *block_next = find_next(block);
-    write_header(block_next, 0, true);
+    if (size == 0 || size >= SIZE_MAX / 2 || align >= SIZE_MAX / 2) {
+        return NULL;
+    }
+    if (align <= dsize) {
+        return allocate(size, NULL);
+    }
+    if (heap_start == NULL) {
+        mm_init();
+    }
+    dbg_requires(mm_checkheap(__LINE__));
 
-    // Coalesce in case the previous block was free
-    return coalesce(block);
+    size_t asize = max(round_up(size + wsize, dsize), mini_block_size);
+    void *bp;
+    if (size >= mmap_threshold) {
+        block_t *block = map_block(asize, align);
+        bp = block == NULL ? NULL : header_to_payload(block);
+    } else {
+        arena_t *arena = arena_acquire();
+        bp = arena_memalign(arena, align, asize);
+        arena_release(arena);
+    }
+
+    dbg_ensures(bp == NULL || (size_t)bp % align == 0);
+    dbg_ensures(mm_checkheap(__LINE__));
+    return bp;
+}
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc; size need not be a multiple of
+ *                    align.
+ */
+void *mm_aligned_alloc(size_t align, size_t size)
+{
+    return mm_memalign(align, size);
+}
+
+/*
+ * mm_posix_memalign - POSIX posix_memalign. Stores the block in *memptr
+ *     and returns 0, or returns EINVAL if align is not a power of two
+ *     multiple of sizeof(void *), or ENOMEM if memory runs out.
+ */
+int mm_posix_memalign(void **memptr, size_t align, size_t size)
+{
+    if (align == 0 || align % sizeof(void *) != 0
+        || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    void *bp = NULL;
+    if (size != 0) {
+        bp = mm_memalign(align, size);
+        if (bp == NULL) {
+            return ENOMEM;
+        }
+    }
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_malloc_usable_size - returns how many bytes the caller may use at bp:
+ *     the slot size of a slab slot, or the payload of a heap or mapped
+ *     block. Any size from the one requested up to this one may be given
+ *     to mm_free_sized.
+ */
+size_t mm_malloc_usable_size(void *bp)
+{
+    if (bp == NULL) {
+        return 0;
+    }
+    run_t *run = run_of(bp);
+    if (run != NULL) {
+        return run->slot_size;
+    }
+    return get_payload_size(payload_to_header(bp));
+}
+
+/*
+ * mm_malloc_at_least - malloc that stores in *actual, unless it is NULL,
+ *     how many bytes the block really holds, at least size.
+ */
+void *mm_malloc_at_least(size_t size, size_t *actual)
+{
+    void *bp = malloc(size);
+    if (actual != NULL) {
+        *actual = mm_malloc_usable_size(bp);
+    }
+    return bp;
+}
+
+/*
+ * mm_malloc_batch - allocates n blocks of size bytes into out and returns
+ *     how many it got, which is fewer than n only when memory runs out.
+ *     Heap blocks are carved side by side out of one fit for all of them
+ *     where there is one, and otherwise out of the holes that hold some
+ *     and one heap extension for the rest. Slab slots are taken under
+ *     one arena acquisition.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t i = 0;
+
+    if (heap_start == NULL) {
+        mm_init();
+    }
+    stat_add(&stats.malloc_batch_calls, 1);
+    if (size > SIZE_MAX / 2) { // No heap or mapping can hold this much
+        return 0;
+    }
+
+    size_t asize = max(round_up(size + wsize, dsize), mini_block_size);
+    if (size == 0 || n == 0 || size >= mmap_threshold) {
+        // Nothing to gain; allocate one by one below
+    } else if (size <= slab_max) {
+        arena_t *arena = arena_acquire();
+        for (; i < n; i++) {
+            out[i] = run_malloc(arena, round_up(size, dsize));
+            if (out[i] == NULL) {
+                break;
+            }
+        }
+        arena_release(arena);
+    } else if (asize <= SIZE_MAX / n) {
+        arena_t *arena = arena_acquire();
+        bool drained = false;
+        while (i < n) {
+            // A fit for all the blocks still wanted, else a hole for as
+            // many as it holds, else one heap extension for the rest
+            block_t *block = find_fit(arena, (n - i) * asize);
+            if (block == NULL) {
+                block = find_fit(arena, asize);
+            }
+            if (block == NULL && !drained) {
+                drained = true;
+                if (drain_caches(arena)) {
+                    continue;
+                }
+            }
+            if (block == NULL) {
+                block = extend_heap(arena, (n - i) * asize);
+                if (block == NULL) {
+                    break;
+                }
+            }
+            size_t count = get_size(block) / asize;
+            if (count > n - i) {
+                count = n - i;
+            }
+            place(arena, block, count * asize);
+            i += split_batch(block, asize, count, out + i);
+        }
+        arena_release(arena);
+    }
+
+    for (; i < n; i++) {
+        out[i] = allocate(size, NULL);
+        if (out[i] == NULL) {
+            break;
+        }
+    }
+    dbg_ensures(mm_checkheap(__LINE__));
+    return i;
+}
+
+/*
+ * split_batch - cuts an allocated block into count blocks of asize bytes,
+ *     the last of which keeps any excess, and stores their payloads in
+ *     out. Returns count.
+ */
+static size_t split_batch(block_t *block, size_t asize, size_t count,
+                          void **out)
+{
+    size_t rest = get_size(block);
+    size_t i;
+    for (i = 0; i < count; i++) {
+        size_t bsize = (i == count - 1) ? rest : asize;
+        if (i == 0) {
+            write_header(block, bsize, true, get_prev_alloc(block),
+                         get_prev_mini(block));
+        } else {
+            write_header(block, bsize, true, true, asize == mini_block_size);
+        }
+        out[i] = header_to_payload(block);
+        rest -= bsize;
+        block = find_next(block);
+    }
+    set_prev_mini(block, get_size(payload_to_header(out[count - 1]))
+                         == mini_block_size);
+    return count;
+}
+
+/*
+ * mm_free_batch - frees the n blocks in ptrs, which it sorts by address.
+ *     Adjacent heap blocks of an arena the caller may work on are merged
+ *     into one free block, so each stretch of them is coalesced once, and
+ *     slots of one of its runs are freed together. Any other pointer is
+ *     freed on its own.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t i;
+
+    stat_add(&stats.free_batch_calls, 1);
+    // Batches often come back in the order they were allocated
+    for (i = 1; i < n && (uintptr_t)ptrs[i - 1] <= (uintptr_t)ptrs[i]; i++) {
+    }
+    if (i < n) {
+        qsort(ptrs, n, sizeof(void *), compare_addresses);
+    }
+    i = 0;
+    while (i < n) {
+        // Take the stretch of slots of one run, or of adjacent heap
+        // blocks, that starts here
+        void *bp = ptrs[i++];
+        size_t first = i - 1;
+        run_t *run = bp == NULL ? NULL : run_of(bp);
+        block_t *block = payload_to_header(bp);
+        if (run != NULL) {
+            while (i < n && run_of(ptrs[i]) == run) {
+                i++;
+            }
+        } else if (bp != NULL && !is_mapped(block)) {
+            while (i < n && ptrs[i] == header_to_payload(find_next(block))) {
+                block = payload_to_header(ptrs[i++]);
+            }
+            block = payload_to_header(bp);
+        }
+
+        arena_t *arena = NULL;
+        if (i - first > 1) {
+            arena = run != NULL ? run->arena : arena_of(block);
+        }
+        if (arena == NULL || (!arena->shared
+                              && (arena != thread_arena
+                                  || thread_generation != arena_generation))) {
+            // Nothing to share, or another thread's arena whose owner
+            // must do the merging
+            for (; first < i; first++) {
+                deallocate(ptrs[first]);
+            }
+            continue;
+        }
+
+        if (arena->shared) {
+            pthread_mutex_lock(&shared_lock);
+        }
+        if (run != NULL) {
+            for (; first < i; first++) {
+                run_free(run, ptrs[first]);
+            }
+        } else {
+            size_t size = 0;
+            for (; first < i; first++) {
+                size += get_size(payload_to_header(ptrs[first]));
+            }
+            write_header(block, size, false, get_prev_alloc(block),
+                         get_prev_mini(block));
+            write_footer(block, size, false);
+            set_prev_mini(find_next(block), false);
+            trim_heap(arena, coalesce(arena, block));
+        }
+        if (arena->shared) {
+            pthread_mutex_unlock(&shared_lock);
+        }
+    }
+    dbg_ensures(mm_checkheap(__LINE__));
+}
+
+/*
+ * compare_addresses - orders pointers by address, for qsort.
+ */
+static int compare_addresses(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void *const *)a;
+    uintptr_t y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+/******** The remaining content below are helper and debug routines ********/
+
+/*
+ * extend_heap - adds a free block of at least size bytes to the arena.
+ * Grows the arena's last segment in place when the break still sits right
+ * behind it, and starts a new segment otherwise. The new block is marked
+ * zeroed when memlib has never handed out its space before.
+ */
+static block_t *extend_heap(arena_t *arena, size_t size) 
+{
+    block_t *block;
+
+    // Allocate an even number of words to maintain alignment
+    size = round_up(size, dsize);
+
+    pthread_mutex_lock(&heap_lock);
+    bool zeroed = mem_zero_lo() == (char *)mem_heap_hi() + 1;
+    if (arena->epilogue != NULL
+        && (char *)mem_heap_hi() + 1 == (char *)arena->epilogue + wsize)
+    {
+        if (mem_sbrk(size) == (void *)-1)
+        {
+            pthread_mutex_unlock(&heap_lock);
+            return NULL;
+        }
+        // Initialize free block header over the old epilogue, which
+        // still records whether the last block is allocated
+        block = arena->epilogue;
+        write_header(block, size, false, get_prev_alloc(block),
+                     get_prev_mini(block));
+    }
+    else
+    {
+        // New segment: prologue footer, the free block, then an epilogue.
+        // Arenas competing for the break take bigger steps.
+        if (multi_arena)
+        {
+            size = max(size, segment_size);
+        }
+        word_t *start;
+        if (num_segments == MAX_SEGMENTS
+            || (start = mem_sbrk(size + dsize)) == (void *)-1)
+        {
+            pthread_mutex_unlock(&heap_lock);
+            return NULL;
+        }
+        start[0] = pack(0, true, true, false); // Prologue footer
+        block = (block_t *)&start[1];
+        write_header(block, size, false, true, false);
+        segments[num_segments].lo = (char *)start;
+        segments[num_segments].arena = arena;
+        __atomic_store_n(&num_segments, num_segments + 1, __ATOMIC_RELEASE);
+    }
+    write_footer(block, size, false);
+    set_zeroed(block, zeroed);
+    stat_add(&stats.extend_calls, 1);
+    stat_add(&stats.extend_bytes, size);
+    // Create new epilogue header
+    arena->epilogue = find_next(block);
+    write_header(arena->epilogue, 0, true, false, false);
+    pthread_mutex_unlock(&heap_lock);
+
+    // Coalesce in case the previous block was free
+    return coalesce(arena, block);
 }
 
 //DIDN'T CHECK
 // Helper function to add a block to the free list
-static void add_to_free_list(block_t *block) {
+static void add_to_free_list(arena_t *arena, block_t *block) {
+    size_t size = get_size(block);
+    int fl, sl;
+
+    if (size == mini_block_size) {
+        block->next_free = arena->mini_free_list;
+        set_mini_prev(block, NULL);
+        if (block->next_free != NULL) {
+            set_mini_prev(block->next_free, block);
+        }
+        arena->mini_free_list = block;
+        return;
+    }
+    if (size >= TREE_MIN_SIZE) {
+        tree_insert(arena, block);
+        return;
+    }
+
+    mapping_insert(size, &fl, &sl);  // Use the previously defined function to get the correct free list index
+
+    // Insert block at the start of the appropriate free list
+    block->next_free = arena->free_list_heads[fl][sl];
+    block->prev_free = NULL;
+
+    // Update the next block's prev_free if the list is not empty
+    if (arena->free_list_heads[fl][sl] != NULL) {
+        arena->free_list_heads[fl][sl]->prev_free = block;
+    }
+
+    // Set the new head of the free list and mark the class non-empty
+    arena->free_list_heads[fl][sl] = block;
+    arena->fl_bitmap |= (word_t)1 << fl;
+    arena->sl_bitmap[fl] |= 1U << sl;
+}
+/*
+ * coalesce - merges the free block with its free neighbours and returns
+ * the merged block. The previous block is only located (through its
+ * footer) when the prev_alloc bit in our header says it is free. The
+ * merged block stays zeroed if all of its parts were, once the boundary
+ * tags and links between them are cleared.
+ */
+static block_t *coalesce(arena_t *arena, block_t *block) {
+    block_t *next_block = find_next(block);
+    bool prev_alloc = get_prev_alloc(block); // Previous block allocated? (the prologue always is)
+    bool next_alloc = get_alloc(next_block); // Check if next block is allocated
+    size_t size = get_size(block);
+
+    stat_add(&stats.coalesce[2 * !prev_alloc + !next_alloc], 1);
+    if (prev_alloc && next_alloc) {  // Case 1: No coalescing
+        set_prev_alloc(next_block, false);
+        add_to_free_list(arena, block);
+        return block;
+    }
+
+    block_t *prev_block = prev_alloc ? NULL : find_prev(block);
+    bool zeroed = get_zeroed(block)
+        && (prev_alloc || get_zeroed(prev_block))
+        && (next_alloc || get_zeroed(next_block));
+
+    if (!prev_alloc) {  // Coalesce with previous block
+        size += get_size(prev_block);
+        remove_from_free_list(arena, prev_block);
+        if (zeroed) {
+            erase_tags(block);
+        }
+        block = prev_block;
+    }
+
+    if (!next_alloc) {  // Coalesce with next block
+        size += get_size(next_block);
+        remove_from_free_list(arena, next_block);
+        if (zeroed) {
+            erase_tags(next_block);
+        }
+    }
+
+    // A free block always follows an allocated one, and a merged block
+    // is never a mini block
+    write_header(block, size, false, true, get_prev_mini(block));
+    write_footer(block, size, false);
+    set_zeroed(block, zeroed);
+    next_block = find_next(block);
+    set_prev_alloc(next_block, false);
+    set_prev_mini(next_block, false);
+    add_to_free_list(arena, block);
+
+    return block;
+}
+/*
+ * absorb_next - merges the free block following an allocated block into
+ *               it, keeping the result allocated.
+ */
+static void absorb_next(arena_t *arena, block_t *block)
+{
+    block_t *next = find_next(block);
+    dbg_requires(get_alloc(block) && !get_alloc(next));
+
+    size_t size = get_size(block) + get_size(next);
+    remove_from_free_list(arena, next);
+    write_header(block, size, true, get_prev_alloc(block), get_prev_mini(block));
+
+    block_t *after = find_next(block);
+    set_prev_alloc(after, true);
+    set_prev_mini(after, false);
+}
+
+/*
+ * shrink_block - trims an allocated block down to asize bytes, returning
+ *                the tail to the free lists when it can form a block.
+ */
+static void shrink_block(arena_t *arena, block_t *block, size_t asize)
+{
+    size_t csize = get_size(block);
+    dbg_requires(get_alloc(block) && asize <= csize);
+
+    if ((csize - asize) < mini_block_size) {
+        return;
+    }
+    stat_add(&stats.splits, 1);
+    write_header(block, asize, true, get_prev_alloc(block), get_prev_mini(block));
+    block_t *tail = find_next(block);
+    size_t tail_size = csize - asize;
+    write_header(tail, tail_size, false, true, asize == mini_block_size);
+    write_footer(tail, tail_size, false);
+    set_prev_mini(find_next(tail), tail_size == mini_block_size);
+    trim_heap(arena, coalesce(arena, tail));
+}
+
+/*
+ * trim_heap - called on a freshly coalesced free block: when it is the
+ *             last block of the heap and bigger than trim_threshold, the
+ *             break is lowered so that only half the threshold remains,
+ *             which keeps a block that is freed and allocated again and
+ *             again from growing and shrinking the heap each time.
+ */
+static void trim_heap(arena_t *arena, block_t *block)
+{
     size_t size = get_size(block);
-    int index = get_free_list_index(size);  // Use the previously defined function to get the correct free list index
+    size_t keep = max(round_up(trim_threshold / 2, dsize), chunksize);
+    if (size <= trim_threshold || size <= keep
+        || find_next(block) != arena->epilogue) {
+        return;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    // Only the segment at the break can shrink
+    if ((char *)mem_heap_hi() + 1 == (char *)arena->epilogue + wsize
+        && mem_sbrk(-(intptr_t)(size - keep)) != (void *)-1) {
+        bool zeroed = get_zeroed(block);
+        remove_from_free_list(arena, block);
+        write_header(block, keep, false, true, get_prev_mini(block));
+        write_footer(block, keep, false);
+        set_zeroed(block, zeroed);
+        arena->epilogue = find_next(block);
+        write_header(arena->epilogue, 0, true, false, false);
+        add_to_free_list(arena, block);
+        stat_add(&stats.trim_calls, 1);
+        stat_add(&stats.trim_bytes, size - keep);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * place - allocates asize bytes at the start of the free block, taking it
+ *         off its free list; a remainder of at least a mini block is
+ *         split off and listed as a free block of its own.
+ */
+static void place(arena_t *arena, block_t *block, size_t asize) {
+    size_t csize = get_size(block);
+    bool prev_alloc = get_prev_alloc(block);
+    bool prev_mini = get_prev_mini(block);
+    bool zeroed = get_zeroed(block);
+
+    remove_from_free_list(arena, block);  // Remove block from its current free list
+
+    if ((csize - asize) >= mini_block_size) {  // Split the block
+        stat_add(&stats.splits, 1);
+        write_header(block, asize, true, prev_alloc, prev_mini);
+        block_t *block_next = find_next(block);
+        size_t remaining_size = csize - asize;
+        write_header(block_next, remaining_size, false, true,
+                     asize == mini_block_size);
+        write_footer(block_next, remaining_size, false);
+        set_zeroed(block_next, zeroed);  // The old links stay in front
+        set_prev_mini(find_next(block_next), remaining_size == mini_block_size);
+        add_to_free_list(arena, block_next);  // Add the remaining part to the free list
+    } else {  // Don't split
+        write_header(block, csize, true, prev_alloc, prev_mini);
+        set_prev_alloc(find_next(block), true);
+    }
+}
+/*
+ * find_fit - Find a fit for a block with asize bytes in the free lists.
+ *
+ * Requests big enough for the tree get its exact best fit. For smaller
+ * ones the request is rounded up to the next class boundary, so the head
+ * of any class at or above the rounded class is guaranteed to fit; the
+ * bitmaps locate the first such class with two bit scans. Only when no
+ * larger class is populated do we fall back to a best-fit scan of the
+ * request's own class, capped at fit_cap blocks, and then to the
+ * smallest block in the tree. Other policies set by mm_set_policy go
+ * through policy_fit instead.
+ */
+static block_t *find_fit(arena_t *arena, size_t asize) {
+    size_t steps = 0;
+    block_t *block = search_fit(arena, asize, &steps);
+    record_fit(asize, block, steps);
+    return block;
+}
+
+/*
+ * search_fit - does the search for find_fit, adding to *steps the list
+ *              blocks and tree nodes it looks at.
+ */
+static block_t *search_fit(arena_t *arena, size_t asize, size_t *steps) {
+    int fl, sl;
+    block_t *block;
+
+    if (asize >= TREE_MIN_SIZE) {
+        return tree_best_fit(arena, asize, steps);
+    }
+    if (asize == mini_block_size && arena->mini_free_list != NULL) {
+        return arena->mini_free_list;
+    }
+
+    if (fit_policy != MM_FIT_GOOD) {
+        block = policy_fit(arena, asize, steps);
+        return block != NULL ? block : tree_best_fit(arena, asize, steps);
+    }
+
+    mapping_search(asize, &fl, &sl);
+    if (fl < FL_INDEX_COUNT) {
+        block = find_suitable_block(arena, &fl, &sl);
+        if (block != NULL) {
+            return block;
+        }
+    }
+
+    // No class guaranteed to fit; search the request's own class
+    mapping_insert(asize, &fl, &sl);
+    block = arena->free_list_heads[fl][sl];
+    block = scan_class(block, block, asize, fit_cap, true, steps);
+    if (block == NULL) {
+        block = tree_best_fit(arena, asize, steps);
+    }
+    return block; // Return the best fit found, or NULL if none found
+}
+
+/*
+ * policy_fit - searches the lists under any policy but the default good
+ *     fit: the request's own class first, scanned from its head (first,
+ *     best and exact best fit) or from the rover (next fit), or only its
+ *     head looked at (segregated fit); then the head of the next
+ *     non-empty class, which surely fits, or for exact best fit the
+ *     whole of that class. Returns NULL if no listed block fits.
+ */
+static block_t *policy_fit(arena_t *arena, size_t asize, size_t *steps)
+{
+    int fl, sl;
+    mapping_insert(asize, &fl, &sl);
+    block_t *head = arena->free_list_heads[fl][sl];
+    block_t *block = NULL;
+
+    switch (fit_policy) {
+    case MM_FIT_FIRST:
+        block = scan_class(head, head, asize, INT_MAX, false, steps);
+        break;
+    case MM_FIT_NEXT: {
+        block_t *start = head;
+        int rfl, rsl;
+        if (arena->rover != NULL) {
+            mapping_insert(get_size(arena->rover), &rfl, &rsl);
+            if (rfl == fl && rsl == sl) {
+                start = arena->rover;
+            }
+        }
+        block = scan_class(head, start, asize, INT_MAX, false, steps);
+        break;
+    }
+    case MM_FIT_BEST:
+        block = scan_class(head, head, asize, fit_cap, true, steps);
+        break;
+    case MM_FIT_EXACT:
+        block = scan_class(head, head, asize, INT_MAX, true, steps);
+        break;
+    default:
+        if (head != NULL) {
+            (*steps)++;
+            block = get_size(head) >= asize ? head : NULL;
+        }
+        break;
+    }
+
+    // Every block of a higher class fits
+    if (block == NULL && ++sl == SL_INDEX_COUNT) {
+        sl = 0;
+        fl++;
+    }
+    if (block == NULL && fl < FL_INDEX_COUNT) {
+        block = find_suitable_block(arena, &fl, &sl);
+        if (block != NULL && fit_policy == MM_FIT_EXACT) {
+            block = scan_class(block, block, asize, INT_MAX, true, steps);
+        }
+    }
+    if (fit_policy == MM_FIT_NEXT && block != NULL) {
+        arena->rover = block->next_free;
+    }
+    return block;
+}
+
+/*
+ * scan_class - walks a class list from start, wrapping around to head,
+ *     looking at up to cap blocks. Returns the first block of at least
+ *     asize bytes, or with best set the smallest such block, stopping
+ *     early on an exact fit; NULL if none is found.
+ */
+static block_t *scan_class(block_t *head, block_t *start, size_t asize,
+                           int cap, bool best, size_t *steps)
+{
+    block_t *best_fit = NULL;
+    size_t min_size_diff = SIZE_MAX;
+    int n = 0;
+    block_t *block = start;
+
+    while (block != NULL) {
+        if (n == cap) {
+            stat_add(&stats.fit_capped, 1);
+            break;
+        }
+        n++;
+        size_t size = get_size(block);
+        if (asize <= size && size - asize < min_size_diff) {
+            best_fit = block;
+            min_size_diff = size - asize;
+            if (!best || min_size_diff == 0) {
+                break;
+            }
+        }
+        block = block->next_free != NULL ? block->next_free : head;
+        if (block == start) {
+            break;
+        }
+    }
+    *steps += n;
+    return best_fit;
+}
+
+/*
+ * record_fit - counts a find_fit call that looked at steps blocks and
+ *              returned block for asize bytes, when counters are kept.
+ */
+static void record_fit(size_t asize, block_t *block, size_t steps)
+{
+    if (!MM_STATS) {
+        return;
+    }
+    stat_add(&stats.fit_searches, 1);
+    stat_add(&stats.fit_steps, steps);
+    stat_add(&stats.fit_depth[steps < MM_STATS_DEPTHS ? steps
+                              : MM_STATS_DEPTHS - 1], 1);
+    if (block == NULL) {
+        stat_add(&stats.fit_misses, 1);
+        return;
+    }
+    int class = 63 - __builtin_clzll(asize);
+    stat_add(&stats.fit_hits[class], 1);
+    stat_add(&stats.fit_waste[class], get_size(block) - asize);
+}
+
+/*
+ * find_suitable_block - returns the head of the first non-empty class at
+ *                       or above (*fl, *sl), updating the indices to that
+ *                       class, or NULL if every such class is empty.
+ */
+static block_t *find_suitable_block(arena_t *arena, int *fl, int *sl)
+{
+    uint32_t sl_map = arena->sl_bitmap[*fl] & (~0U << *sl);
+    if (sl_map == 0) {
+        // Nothing left on this level; move up to the next non-empty one
+        word_t fl_map = (*fl + 1 < FL_INDEX_COUNT)
+            ? arena->fl_bitmap & (~(word_t)0 << (*fl + 1)) : 0;
+        if (fl_map == 0) {
+            return NULL;
+        }
+        *fl = __builtin_ctzll(fl_map);
+        sl_map = arena->sl_bitmap[*fl];
+    }
+    *sl = __builtin_ctz(sl_map);
+    return arena->free_list_heads[*fl][*sl];
+}
+
+/*
+ * tree_before: tells whether free block a orders before free block b in
+ *              the tree, comparing sizes first and addresses second.
+ */
+static bool tree_before(block_t *a, block_t *b)
+{
+    size_t a_size = get_size(a);
+    size_t b_size = get_size(b);
+    return a_size < b_size || (a_size == b_size && a < b);
+}
+
+/*
+ * tree_red: tells whether a tree node is red; missing leaves are black.
+ */
+static bool tree_red(block_t *node)
+{
+    return node != NULL && node->red;
+}
+
+/*
+ * tree_replace: hangs with (possibly NULL) where node hangs in the tree.
+ */
+static void tree_replace(arena_t *arena, block_t *node, block_t *with)
+{
+    if (node->parent == NULL) {
+        arena->tree_root = with;
+    } else {
+        node->parent->child[node == node->parent->child[1]] = with;
+    }
+}
+
+/*
+ * tree_rotate: rotates node down towards child[dir], lifting its other
+ *              child into its place.
+ */
+static void tree_rotate(arena_t *arena, block_t *node, int dir)
+{
+    block_t *up = node->child[!dir];
+    node->child[!dir] = up->child[dir];
+    if (up->child[dir] != NULL) {
+        up->child[dir]->parent = node;
+    }
+    up->parent = node->parent;
+    tree_replace(arena, node, up);
+    up->child[dir] = node;
+    node->parent = up;
+}
+
+/*
+ * tree_insert: adds a free block to the arena's tree and rebalances it.
+ */
+static void tree_insert(arena_t *arena, block_t *block)
+{
+    block_t *parent = NULL;
+    block_t **link = &arena->tree_root;
+    while (*link != NULL) {
+        parent = *link;
+        link = &parent->child[tree_before(parent, block)];
+    }
+    block->child[0] = NULL;
+    block->child[1] = NULL;
+    block->parent = parent;
+    block->red = true;
+    *link = block;
+
+    // Resolve red-red conflicts upwards; the grandparent of a red parent
+    // exists, because the root is black
+    while (tree_red(block->parent)) {
+        parent = block->parent;
+        block_t *grand = parent->parent;
+        int dir = (parent == grand->child[1]);
+        block_t *uncle = grand->child[!dir];
+        if (tree_red(uncle)) {
+            parent->red = false;
+            uncle->red = false;
+            grand->red = true;
+            block = grand;
+            continue;
+        }
+        if (block == parent->child[!dir]) {
+            tree_rotate(arena, parent, dir);
+            parent = block;
+        }
+        parent->red = false;
+        grand->red = true;
+        tree_rotate(arena, grand, !dir);
+        break;
+    }
+    arena->tree_root->red = false;
+}
+
+/*
+ * tree_remove: unlinks a free block from the arena's tree, putting its
+ *              in-order successor in its place if it has two children.
+ */
+static void tree_remove(arena_t *arena, block_t *block)
+{
+    block_t *child;
+    block_t *parent;
+    bool red;
+
+    if (block->child[0] != NULL && block->child[1] != NULL) {
+        block_t *next = block->child[1];
+        while (next->child[0] != NULL) {
+            next = next->child[0];
+        }
+        child = next->child[1];
+        red = next->red;
+        if (next->parent == block) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            parent->child[0] = child;
+            if (child != NULL) {
+                child->parent = parent;
+            }
+            next->child[1] = block->child[1];
+            next->child[1]->parent = next;
+        }
+        next->child[0] = block->child[0];
+        next->child[0]->parent = next;
+        next->parent = block->parent;
+        next->red = block->red;
+        tree_replace(arena, block, next);
+    } else {
+        child = block->child[block->child[0] == NULL];
+        parent = block->parent;
+        red = block->red;
+        if (child != NULL) {
+            child->parent = parent;
+        }
+        tree_replace(arena, block, child);
+    }
+
+    // Taking out a black node leaves its side one black node short
+    if (!red) {
+        tree_fix_removal(arena, child, parent);
+    }
+}
+
+/*
+ * tree_fix_removal: restores the black height after removal left the
+ *                   subtree at node (possibly NULL, under parent) one
+ *                   black node short.
+ */
+static void tree_fix_removal(arena_t *arena, block_t *node, block_t *parent)
+{
+    while (node != arena->tree_root && !tree_red(node)) {
+        int dir = (node != parent->child[0]);
+        block_t *sibling = parent->child[!dir];
+        if (sibling->red) {
+            sibling->red = false;
+            parent->red = true;
+            tree_rotate(arena, parent, dir);
+            sibling = parent->child[!dir];
+        }
+        if (!tree_red(sibling->child[0]) && !tree_red(sibling->child[1])) {
+            sibling->red = true;
+            node = parent;
+            parent = node->parent;
+            continue;
+        }
+        if (!tree_red(sibling->child[!dir])) {
+            sibling->child[dir]->red = false;
+            sibling->red = true;
+            tree_rotate(arena, sibling, !dir);
+            sibling = parent->child[!dir];
+        }
+        sibling->red = parent->red;
+        parent->red = false;
+        sibling->child[!dir]->red = false;
+        tree_rotate(arena, parent, dir);
+        node = arena->tree_root;
+    }
+    if (node != NULL) {
+        node->red = false;
+    }
+}
+
+/*
+ * tree_best_fit: returns the smallest block in the tree holding at least
+ *                asize bytes, the lowest such one on ties, or NULL. Adds
+ *                the nodes it visits to *steps.
+ */
+static block_t *tree_best_fit(arena_t *arena, size_t asize, size_t *steps)
+{
+    block_t *best = NULL;
+    block_t *node = arena->tree_root;
+    while (node != NULL) {
+        (*steps)++;
+        if (get_size(node) >= asize) {
+            best = node;
+            node = node->child[0];
+        } else {
+            node = node->child[1];
+        }
+    }
+    return best;
+}
+
+/*
+ * tree_aligned_fit - returns the smallest block below node, short of limit
+ *     bytes, that holds a block of asize bytes with an aligned payload.
+ */
+static block_t *tree_aligned_fit(block_t *node, size_t align, size_t asize,
+                                 size_t limit)
+{
+    if (node == NULL) {
+        return NULL;
+    }
+    size_t size = get_size(node);
+    if (size >= asize) {
+        block_t *fit = tree_aligned_fit(node->child[0], align, asize, limit);
+        if (fit != NULL) {
+            return fit;
+        }
+        if (size < limit && size >= aligned_gap(node, align) + asize) {
+            return node;
+        }
+    }
+    if (size >= limit) {
+        return NULL;
+    }
+    return tree_aligned_fit(node->child[1], align, asize, limit);
+}
+
+/* 
+ * mm_checkheap - checks the heap, printing what is wrong under DEBUG and
+ * returning false if anything is. Walks every segment of the heap in
+ * address order, checking each block and its boundary tags, then checks
+ * the free lists of every arena in use. Only meaningful while no other
+ * thread is inside the allocator.
+ */
+bool mm_checkheap(int line)  
+{ 
+    // Check if the heap has been initialized
+    if (heap_start == NULL) {
+        dbg_printf("Heap is not initialized.\n");
+        return false;
+    }
+
+    word_t *prologue = (word_t *)mem_heap_lo();
+    char *heap_end = (char *)mem_heap_hi() + 1;
+    while ((char *)prologue < heap_end) {
+        if (*prologue != pack(0, true, true, false)) {
+            dbg_printf("Error: Bad segment prologue at line %d\n", line);
+            return false;
+        }
+        block_t *current = (block_t *)(prologue + 1);
+        while (get_size(current) > 0) {
+            if (!check_block(current, line)) {
+                return false;
+            }
+            current = find_next(current);
+        }
+
+        // Check the final block for correctness
+        if (!get_alloc(current) || get_size(current) != 0) {
+            dbg_printf("Error: Final block is not correct at line %d\n", line);
+            return false;
+        }
+        prologue = (word_t *)current + 1;
+    }
+
+    int k;
+    for (k = 0; k < NUM_ARENAS; k++) {
+        if (arenas[k].generation == arena_generation
+            && !check_arena(&arenas[k], line)) {
+            return false;
+        }
+    }
+    if (!check_tcache(line)) {
+        return false;
+    }
+    dbg_printf("check-heap passed\n");
+    (void) line;
+    return true;
+}
+
+/*
+ * check_block - checks alignment, size and boundary tags of one block.
+ */
+static bool check_block(block_t *current, int line)
+{
+    // Check alignment of each block
+    dbg_printf("checkHeap: Payload is at line %d, address: %p\n", line, header_to_payload(current));
+    if (((size_t)header_to_payload(current) % dsize) != 0) {
+        dbg_printf("Error: Block not aligned at line %d\n", line);
+        return false;
+    }
+
+    // Check if each block's size meets the minimum block size requirement
+    if (get_size(current) < mini_block_size) {
+        dbg_printf("Error: Block size is less than minimum at line %d\n", line);
+        return false;
+    }
+
+    // Check that the prev_alloc bit of the next block mirrors ours
+    if (get_prev_alloc(find_next(current)) != get_alloc(current)) {
+        dbg_printf("Error: prev_alloc bit out of sync at line %d\n", line);
+        return false;
+    }
+    if (get_prev_mini(find_next(current)) !=
+        (get_size(current) == mini_block_size)) {
+        dbg_printf("Error: prev_mini bit out of sync at line %d\n", line);
+        return false;
+    }
+
+    // For free blocks, check if headers and footers match
+    if (!get_alloc(current) && get_size(current) > mini_block_size) {
+        word_t *footerp = (word_t *)((current->payload) + get_size(current) - dsize);
+        if (extract_size(current->header) != extract_size(*footerp)) {
+            dbg_printf("Error: Header and footer do not match at line %d\n", line);
+            return false;
+        }
+        // A zeroed block must be zero between its links and its footer
+        word_t *word;
+        for (word = (word_t *)current->payload + link_words;
+             get_zeroed(current) && word < footerp; word++) {
+            if (*word != 0) {
+                dbg_printf("Error: Zeroed block %p is dirty at line %d\n", (void *)current, line);
+                return false;
+            }
+        }
+    }
+
+    // Check for contiguous free blocks that have not been coalesced
+    if (!get_alloc(current) && !get_alloc(find_next(current))) {
+        dbg_printf("Error: Contiguous free blocks not coalesced at line %d\n", line);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * check_arena - checks the free lists and bitmaps of one arena.
+ */
+static bool check_arena(arena_t *arena, int line)
+{
+    int i, j;
+
+    // Check that the mini list holds free mini blocks of this arena only
+    block_t *mini;
+    block_t *prev = NULL;
+    for (mini = arena->mini_free_list; mini != NULL; mini = mini->next_free) {
+        if (get_alloc(mini) || get_size(mini) != mini_block_size
+            || arena_of(mini) != arena || get_mini_prev(mini) != prev) {
+            dbg_printf("Error: Bad block %p on mini list at line %d\n", (void *)mini, line);
+            return false;
+        }
+        prev = mini;
+    }
+
+    // Check that quick lists hold still-allocated blocks of their size
+    for (i = 0; i < QUICK_BINS; i++) {
+        block_t *block;
+        for (block = arena->quick_lists[i]; block != NULL; block = block->next_free) {
+            if (!get_alloc(block) || get_size(block) != (size_t)(i + 1) * dsize
+                || arena_of(block) != arena || !arena->quick_pending) {
+                dbg_printf("Error: Bad block %p on quick list at line %d\n", (void *)block, line);
+                return false;
+            }
+        }
+    }
+
+    // Check that the bitmaps agree with the lists and that every listed
+    // block is free, linked both ways and filed under its own class
+    for (i = 0; i < FL_INDEX_COUNT; i++) {
+        if (((arena->fl_bitmap >> i) & 1) != (arena->sl_bitmap[i] != 0)) {
+            dbg_printf("Error: First-level bitmap mismatch at line %d\n", line);
+            return false;
+        }
+        for (j = 0; j < SL_INDEX_COUNT; j++) {
+            block_t *block = arena->free_list_heads[i][j];
+            if (((arena->sl_bitmap[i] >> j) & 1) != (block != NULL)) {
+                dbg_printf("Error: Second-level bitmap mismatch at line %d\n", line);
+                return false;
+            }
+            for (; block != NULL; block = block->next_free) {
+                int fl, sl;
+                mapping_insert(get_size(block), &fl, &sl);
+                if (get_alloc(block) || fl != i || sl != j
+                    || arena_of(block) != arena) {
+                    dbg_printf("Error: Block %p misfiled at line %d\n", (void *)block, line);
+                    return false;
+                }
+                if (block->next_free != NULL && block->next_free->prev_free != block) {
+                    dbg_printf("Error: Broken free list links at line %d\n", line);
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Check the tree of big free blocks
+    if (tree_red(arena->tree_root)
+        || (arena->tree_root != NULL && arena->tree_root->parent != NULL)) {
+        dbg_printf("Error: Bad tree root at line %d\n", line);
+        return false;
+    }
+    return check_tree(arena, arena->tree_root, NULL, NULL, line) >= 0
+        && check_runs(arena, line);
+}
+
+/*
+ * check_runs - checks that the listed slab runs of an arena are mapped
+ *              allocated blocks with free slots, filed by slot size, and
+ *              that their bitmaps agree with their counts.
+ */
+static bool check_runs(arena_t *arena, int line)
+{
+    int i, j;
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        run_t *prev = NULL;
+        run_t *run;
+        for (run = arena->runs[i]; run != NULL; prev = run, run = run->next) {
+            block_t *block = payload_to_header(run);
+            unsigned free_slots = 0;
+            for (j = 0; j < RUN_BITMAP_WORDS; j++) {
+                free_slots += __builtin_popcountll(run->bitmap[j]);
+            }
+            if (run_of(run) != run || run->arena != arena || run->prev != prev
+                || !get_alloc(block) || get_size(block) != RUN_SIZE
+                || run->slot_size != (size_t)(i + 1) * dsize
+                || run->free_slots == 0 || run->free_slots > run->num_slots
+                || free_slots != run->free_slots) {
+                dbg_printf("Error: Bad slab run %p at line %d\n", (void *)run, line);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * check_tree - checks the subtree at node, whose blocks must all order
+ *              between lo and hi (where not NULL): free blocks of this
+ *              arena, big enough for the tree, correctly linked, with no
+ *              red node under a red one. Returns the subtree's black
+ *              height, or -1 on error.
+ */
+static int check_tree(arena_t *arena, block_t *node, block_t *lo,
+                      block_t *hi, int line)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    if (get_alloc(node) || get_size(node) < TREE_MIN_SIZE
+        || arena_of(node) != arena
+        || (lo != NULL && !tree_before(lo, node))
+        || (hi != NULL && !tree_before(node, hi))) {
+        dbg_printf("Error: Block %p misplaced in tree at line %d\n", (void *)node, line);
+        return -1;
+    }
+    int dir;
+    for (dir = 0; dir < 2; dir++) {
+        block_t *child = node->child[dir];
+        if (child != NULL && (child->parent != node
+                              || (node->red && child->red))) {
+            dbg_printf("Error: Bad tree links at %p at line %d\n", (void *)node, line);
+            return -1;
+        }
+    }
+    int left = check_tree(arena, node->child[0], lo, node, line);
+    int right = check_tree(arena, node->child[1], node, hi, line);
+    if (left < 0 || right < 0 || left != right) {
+        if (left >= 0 && right >= 0) {
+            dbg_printf("Error: Unequal black heights at %p at line %d\n", (void *)node, line);
+        }
+        return -1;
+    }
+    return left + !node->red;
+}
+
+/*
+ * check_tcache - checks that the calling thread's cache holds allocated
+ *                blocks of its own arena, each filed in the bin of its size.
+ */
+static bool check_tcache(int line)
+{
+    if (!tcache_valid()) {
+        return true;
+    }
+    int i;
+    for (i = 0; i < TCACHE_BINS; i++) {
+        unsigned count = 0;
+        block_t *block;
+        for (block = tcache.bins[i]; block != NULL; block = block->next_free) {
+            if (!get_alloc(block) || get_size(block) != (i + 1) * dsize
+                || arena_of(block) != thread_arena) {
+                dbg_printf("Error: Bad block %p in thread cache at line %d\n", (void *)block, line);
+                return false;
+            }
+            count++;
+        }
+        if (count != tcache.counts[i] || count > TCACHE_BIN_COUNT) {
+            dbg_printf("Error: Thread cache count mismatch at line %d\n", line);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * arena_reset - empties the free lists of an arena for a new generation.
+ */
+static void arena_reset(arena_t *arena)
+{
+    int i, j;
+    for (i = 0; i < FL_INDEX_COUNT; i++) {
+        for (j = 0; j < SL_INDEX_COUNT; j++) {
+            arena->free_list_heads[i][j] = NULL;
+        }
+        arena->sl_bitmap[i] = 0;
+    }
+    for (i = 0; i < QUICK_BINS; i++) {
+        arena->quick_lists[i] = NULL;
+    }
+    arena->quick_pending = false;
+    arena->fl_bitmap = 0;
+    arena->mini_free_list = NULL;
+    arena->tree_root = NULL;
+    arena->rover = NULL;
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        arena->runs[i] = NULL;
+    }
+    arena->epilogue = NULL;
+    arena->remote_free = NULL;
+    arena->generation = arena_generation;
+}
+
+/*
+ * arena_bind - binds the calling thread to the first unowned private
+ *              arena, or to the shared arena if all of them are taken.
+ */
+static arena_t *arena_bind(void)
+{
+    arena_t *arena = &arenas[NUM_ARENAS - 1];
+    int i;
+
+    pthread_once(&arena_key_once, arena_key_create);
+    for (i = 0; i < NUM_ARENAS - 1; i++) {
+        unsigned owner = __atomic_load_n(&arenas[i].owner_generation, __ATOMIC_RELAXED);
+        if (owner != arena_generation
+            && __atomic_compare_exchange_n(&arenas[i].owner_generation, &owner,
+                                           arena_generation, false,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            arena = &arenas[i];
+            break;
+        }
+    }
+
+    if (arena->shared) {
+        pthread_mutex_lock(&shared_lock);
+    }
+    if (arena->generation != arena_generation) {
+        arena_reset(arena);
+    }
+    if (arena->shared) {
+        pthread_mutex_unlock(&shared_lock);
+    }
+    if (arena != &arenas[0]) {
+        __atomic_store_n(&multi_arena, true, __ATOMIC_RELEASE);
+    }
+
+    thread_arena = arena;
+    thread_generation = arena_generation;
+    pthread_setspecific(arena_key, arena);
+    return arena;
+}
+
+/*
+ * arena_unbind - thread exit hook: empties the thread cache and gives up
+ *                the thread's private arena, unless mm_init has already
+ *                handed it out again.
+ */
+static void arena_unbind(void *arg)
+{
+    arena_t *arena = arg;
+    if (tcache_valid()) {
+        arena_t *held = arena_acquire();
+        tcache_drain(held);
+        arena_release(held);
+        __atomic_fetch_add(&tcache_lookups, tcache.lookups, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&tcache_hits, tcache.hits, __ATOMIC_RELAXED);
+        tcache.generation = 0;
+    }
+    if (!arena->shared) {
+        unsigned owner = thread_generation;
+        __atomic_compare_exchange_n(&arena->owner_generation, &owner, 0, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * arena_key_create - creates the key whose destructor unbinds arenas.
+ */
+static void arena_key_create(void)
+{
+    pthread_key_create(&arena_key, arena_unbind);
+}
+
+/*
+ * arena_acquire - returns the calling thread's arena, ready for use:
+ *                 locked if shared, with pending remote frees reclaimed.
+ */
+static arena_t *arena_acquire(void)
+{
+    arena_t *arena = thread_arena;
+    if (arena == NULL || thread_generation != arena_generation) {
+        arena = arena_bind();
+    }
+    if (arena->shared) {
+        pthread_mutex_lock(&shared_lock);
+    } else if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED) != NULL) {
+        reclaim_remote_frees(arena);
+    }
+    return arena;
+}
+
+/*
+ * arena_release - ends a call begun with arena_acquire.
+ */
+static void arena_release(arena_t *arena)
+{
+    if (arena->shared) {
+        pthread_mutex_unlock(&shared_lock);
+    }
+}
+
+/*
+ * arena_of - returns the arena owning a block, by binary search for the
+ *            last segment that starts below it.
+ */
+static arena_t *arena_of(block_t *block)
+{
+    if (!__atomic_load_n(&multi_arena, __ATOMIC_ACQUIRE)) {
+        return &arenas[0];
+    }
+    size_t lo = 0;
+    size_t hi = __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE);
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (segments[mid].lo <= (char *)block) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return segments[lo].arena;
+}
+
+/*
+ * remote_free - pushes a block onto the remote free stack of its arena,
+ *               leaving it marked allocated until the owner reclaims it.
+ *               A slab slot is pushed through the block its payload would
+ *               have, whose header is never read.
+ */
+static void remote_free(arena_t *arena, block_t *block)
+{
+    block_t *head = __atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED);
+    do {
+        block->next_free = head;
+    } while (!__atomic_compare_exchange_n(&arena->remote_free, &head, block,
+                                          true, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+/*
+ * reclaim_remote_frees - frees every block other threads have pushed onto
+ *                        the arena's remote free stack.
+ */
+static void reclaim_remote_frees(arena_t *arena)
+{
+    block_t *block = __atomic_exchange_n(&arena->remote_free, NULL,
+                                         __ATOMIC_ACQUIRE);
+    while (block != NULL) {
+        block_t *next = block->next_free;
+        arena_free(arena, header_to_payload(block));
+        block = next;
+    }
+}
+
+/*
+ * tcache_valid - tells whether the thread cache belongs to the current
+ *                generation and so may be used.
+ */
+static bool tcache_valid(void)
+{
+    return tcache.generation == arena_generation
+        && thread_generation == arena_generation;
+}
+
+/*
+ * tcache_get - pops a cached block of asize bytes, or returns NULL if the
+ *              bin is empty. Drops a cache left over from an old heap.
+ */
+static void *tcache_get(size_t asize)
+{
+    if (!tcache_valid()) {
+        memset(&tcache, 0, sizeof(tcache));
+        if (thread_generation != arena_generation) {
+            return NULL;
+        }
+        tcache.generation = arena_generation;
+    }
+    int bin = asize / dsize - 1;
+    block_t *block = tcache.bins[bin];
+    tcache.lookups++;
+    if (block == NULL) {
+        return NULL;
+    }
+    tcache.hits++;
+    tcache.bins[bin] = block->next_free;
+    tcache.counts[bin]--;
+    return header_to_payload(block);
+}
+
+/*
+ * tcache_put - caches a freed small block of the given size if it
+ *              belongs to the thread's arena, flushing the oldest part of
+ *              a full bin first.
+ *              Returns false if the block must be freed normally.
+ */
+static bool tcache_put(block_t *block, size_t size)
+{
+    if (!tcache_valid() || arena_of(block) != thread_arena) {
+        return false;
+    }
+    int bin = size / dsize - 1;
+    if (tcache.counts[bin] == TCACHE_BIN_COUNT) {
+        arena_t *arena = arena_acquire();
+        tcache_flush(arena, bin, TCACHE_BATCH);
+        arena_release(arena);
+    }
+    block->next_free = tcache.bins[bin];
+    tcache.bins[bin] = block;
+    tcache.counts[bin]++;
+    return true;
+}
+
+/*
+ * tcache_refill - after a miss on a bin, moves up to TCACHE_BATCH - 1
+ *                 more blocks of the same size from the arena into it, so
+ *                 the next requests of this size hit. Only class heads
+ *                 of exactly this size are taken: splitting larger
+ *                 blocks ahead of demand would strand memory in the
+ *                 cache.
+ */
+static void tcache_refill(arena_t *arena, size_t asize)
+{
+    if (!tcache_valid()) {
+        return;
+    }
+    int bin = asize / dsize - 1;
+    int fl, sl;
+    mapping_insert(asize, &fl, &sl);
+    int n;
+    for (n = 1; n < TCACHE_BATCH && tcache.counts[bin] < TCACHE_BIN_COUNT; n++) {
+        block_t *block = arena->quick_pending ? quick_get(arena, asize) : NULL;
+        if (block == NULL) {
+            block = (asize == mini_block_size)
+                ? arena->mini_free_list : arena->free_list_heads[fl][sl];
+            if (block == NULL || get_size(block) != asize) {
+                break;
+            }
+            place(arena, block, asize);
+        }
+        block->next_free = tcache.bins[bin];
+        tcache.bins[bin] = block;
+        tcache.counts[bin]++;
+    }
+}
+
+/*
+ * tcache_flush - frees the count oldest blocks of a bin back into the
+ *                thread's arena, which the caller has acquired.
+ */
+static void tcache_flush(arena_t *arena, int bin, unsigned count)
+{
+    if (count == 0) {
+        return;
+    }
+    // Keep the newest blocks; they sit at the front of the bin
+    block_t **linkp = &tcache.bins[bin];
+    unsigned keep;
+    for (keep = tcache.counts[bin] - count; keep > 0; keep--) {
+        linkp = &(*linkp)->next_free;
+    }
+    block_t *block = *linkp;
+    *linkp = NULL;
+    tcache.counts[bin] -= count;
+
+    while (block != NULL) {
+        block_t *next = block->next_free;
+        free_block(arena, block);
+        block = next;
+    }
+}
+
+/*
+ * tcache_drain - frees every cached block back into the thread's arena,
+ *                which the caller has acquired. Returns whether there
+ *                were any.
+ */
+static bool tcache_drain(arena_t *arena)
+{
+    bool drained = false;
+    int i;
+
+    if (!tcache_valid() || arena != thread_arena) {
+        return false;
+    }
+    for (i = 0; i < TCACHE_BINS; i++) {
+        drained = drained || tcache.counts[i] != 0;
+        tcache_flush(arena, i, tcache.counts[i]);
+    }
+    return drained;
+}
+
+/*
+ * map_block - serves a block of asize bytes, with its payload aligned to
+ *     align, from a mapping of its own. The payload starts at the first
+ *     multiple of align at least dsize into the mapping, which is never
+ *     further in than max(align, dsize) since the mapping starts on a
+ *     page; the word before the header records how far in the header
+ *     is. The recorded size runs to one word short of the mapping's end,
+ *     so it stays a multiple of dsize. Returns NULL if the mapping cannot
+ *     be had.
+ */
+static block_t *map_block(size_t asize, size_t align)
+{
+    size_t pagesize = mem_pagesize();
+    if (asize > SIZE_MAX - max(align, dsize) - pagesize) {
+        return NULL;
+    }
+    size_t length = round_up(max(align, dsize) + asize, pagesize);
+    char *base = mem_map(length);
+    if (base == NULL) {
+        return NULL;
+    }
+    size_t offset = round_up((uintptr_t)base + dsize, align)
+        - (uintptr_t)base - wsize;
+    block_t *block = (block_t *)(base + offset);
+    *((word_t *)block - 1) = offset;
+    write_header(block, length - offset - wsize, true, true, false);
+    return block;
+}
 
-    // Insert block at the start of the appropriate free list
-    block->next_free = free_list_heads[index];
-    block->prev_free = NULL;
+/*
+ * mapped_offset - returns how far into its mapping a mapped block starts.
+ */
+static size_t mapped_offset(block_t *block)
+{
+    return (size_t)*((word_t *)block - 1);
+}
 
-    // Update the next block's prev_free if the list is not empty
-    if (free_list_heads[index] != NULL) {
-        free_list_heads[index]->prev_free = block;
+/*
+ * unmap_block - releases the mapping of a mapped block.
+ */
+static void unmap_block(block_t *block)
+{
+    size_t offset = mapped_offset(block);
+    mem_unmap((char *)block - offset, offset + get_size(block) + wsize);
+}
+
+/*
+ * remap_block - resizes the mapping of a mapped block to hold asize
+ *               bytes, possibly moving it. The block keeps its offset
+ *               into the mapping, though not an alignment beyond a page.
+ *               Returns NULL on failure, with the block left intact.
+ */
+static block_t *remap_block(block_t *block, size_t asize)
+{
+    size_t pagesize = mem_pagesize();
+    size_t offset = mapped_offset(block);
+    if (asize > SIZE_MAX - offset - wsize - pagesize) {
+        return NULL;
+    }
+    size_t length = round_up(offset + wsize + asize, pagesize);
+    char *base = mem_remap((char *)block - offset,
+                           offset + get_size(block) + wsize, length);
+    if (base == NULL) {
+        return NULL;
     }
+    block = (block_t *)(base + offset);
+    write_header(block, length - offset - wsize, true, true, false);
+    return block;
+}
 
-    // Set the new head of the free list
-    free_list_heads[index] = block;
+/*
+ * is_mapped - tells whether an allocated block lives in a mapping of its
+ *             own rather than on the heap.
+ */
+static bool is_mapped(block_t *block)
+{
+    return (char *)block < (char *)mem_heap_lo()
+        || (char *)block > (char *)mem_heap_hi();
 }
+
 /*
- * <what does coalesce do?>
+ * mm_set_mmap_threshold - requests of at least threshold bytes are served
+ *     from mappings of their own, released as soon as they are freed.
+ *     SIZE_MAX keeps every block on the heap.
  */
-static block_t *coalesce(block_t *block) {
-    block_t *prev_block = find_prev(block);
-    block_t *next_block = find_next(block);
-    bool prev_alloc = get_alloc(prev_block) || prev_block == block; // Check if previous block is allocated or if it is the same as the current block (at the start of the heap)
-    bool next_alloc = get_alloc(next_block); // Check if next block is allocated
-    size_t size = get_size(block);
+void mm_set_mmap_threshold(size_t threshold)
+{
+    mmap_threshold = threshold;
+}
 
-    if (prev_alloc && next_alloc) {  // Case 1: No coalescing
-        add_to_free_list(block);
-        return block;
-    }
+/*
+ * mm_set_trim_threshold - once a free block of more than threshold bytes
+ *     ends the heap, the heap is shrunk back to keep only half the
+ *     threshold of it. SIZE_MAX never shrinks the heap.
+ */
+void mm_set_trim_threshold(size_t threshold)
+{
+    trim_threshold = threshold;
+}
 
-    if (!prev_alloc) {  // Coalesce with previous block
-        size += get_size(prev_block);
-        remove_from_free_list(prev_block);
-        block = prev_block;
+/*
+ * quick_get - pops a deferred block of exactly asize bytes off its quick
+ *             list. The block is still marked allocated.
+ */
+static block_t *quick_get(arena_t *arena, size_t asize)
+{
+    int bin = asize / dsize - 1;
+    block_t *block = arena->quick_lists[bin];
+    if (block != NULL) {
+        arena->quick_lists[bin] = block->next_free;
     }
+    return block;
+}
 
-    if (!next_alloc) {  // Coalesce with next block
-        size += get_size(next_block);
-        remove_from_free_list(next_block);
+/*
+ * consolidate - frees and coalesces every block waiting on the arena's
+ *               quick lists. Returns whether there were any.
+ */
+static bool consolidate(arena_t *arena)
+{
+    int i;
+
+    if (!arena->quick_pending) {
+        return false;
+    }
+    arena->quick_pending = false;
+    for (i = 0; i < QUICK_BINS; i++) {
+        block_t *block = arena->quick_lists[i];
+        arena->quick_lists[i] = NULL;
+        while (block != NULL) {
+            block_t *next = block->next_free;
+            size_t size = get_size(block);
+            write_header(block, size, false, get_prev_alloc(block),
+                         get_prev_mini(block));
+            write_footer(block, size, false);
+            trim_heap(arena, coalesce(arena, block));
+            block = next;
+        }
     }
+    return true;
+}
 
-    write_header(block, size, false);
-    write_footer(block, size, false);
-    add_to_free_list(block);
+/*
+ * mm_set_deferred_coalescing - with on set, small blocks are no longer
+ *     coalesced as they are freed but parked on exact-size quick lists,
+ *     and merged in one pass when a fit fails. Blocks already parked are
+ *     still merged that way after the mode is turned off.
+ */
+void mm_set_deferred_coalescing(bool on)
+{
+    deferred_coalescing = on;
+}
 
-    return block;
+/*
+ * run_of - returns the slab run holding a payload pointer, or NULL if it
+ *          is not a slot.
+ */
+static run_t *run_of(void *bp)
+{
+    size_t page = (size_t)((char *)bp - run_map_base) / RUN_SIZE;
+    if (page >= RUN_MAP_PAGES || !run_map[page]) {
+        return NULL;
+    }
+    return (run_t *)(run_map_base + page * RUN_SIZE);
 }
+
 /*
- * <what does place do?>
+ * run_create - turns a new block of the arena into a run of slots of
+ *              slot_size bytes and lists it. Returns NULL if no block can
+ *              be had, or if it lies beyond the run map.
  */
-static void place(block_t *block, size_t asize) {
-    size_t csize = get_size(block);
+static run_t *run_create(arena_t *arena, size_t slot_size)
+{
+    void *bp = arena_memalign(arena, RUN_SIZE, RUN_SIZE);
+    if (bp == NULL) {
+        return NULL;
+    }
+    size_t page = (size_t)((char *)bp - run_map_base) / RUN_SIZE;
+    if (page >= RUN_MAP_PAGES) {
+        free_block(arena, payload_to_header(bp));
+        return NULL;
+    }
+
+    run_t *run = bp;
+    size_t offset = round_up(sizeof(run_t), dsize);
+    size_t n = (get_payload_size(payload_to_header(bp)) - offset) / slot_size;
+    run->arena = arena;
+    run->slot_size = slot_size;
+    run->num_slots = n;
+    run->free_slots = n;
+    int i;
+    for (i = 0; i < RUN_BITMAP_WORDS; i++) {
+        run->bitmap[i] = n >= 64 ? ~(word_t)0 : ((word_t)1 << n) - 1;
+        n -= n >= 64 ? 64 : n;
+    }
+    run->prev = NULL;
+    run->next = NULL;
+    run_link(run);
+
+    run_map[page] = 1;
+    size_t top = __atomic_load_n(&run_map_top, __ATOMIC_RELAXED);
+    while (top <= page
+           && !__atomic_compare_exchange_n(&run_map_top, &top, page + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return run;
+}
 
-    remove_from_free_list(block);  // Remove block from its current free list
+/*
+ * run_malloc - hands out the lowest free slot of the first listed run of
+ *              slot_size bytes, making a new run if there is none.
+ */
+static void *run_malloc(arena_t *arena, size_t slot_size)
+{
+    run_t *run = arena->runs[slot_size / dsize - 1];
+    if (run == NULL) {
+        run = run_create(arena, slot_size);
+        if (run == NULL) {
+            return NULL;
+        }
+    }
 
-    if ((csize - asize) >= min_block_size) {  // Split the block
-        write_header(block, asize, true);
-        write_footer(block, asize, true);
-        block_t *block_next = find_next(block);
-        size_t remaining_size = csize - asize;
-        write_header(block_next, remaining_size, false);
-        write_footer(block_next, remaining_size, false);
-        add_to_free_list(block_next);  // Add the remaining part to the free list
-    } else {  // Don't split
-        write_header(block, csize, true);
-        write_footer(block, csize, true);
+    int i = 0;
+    while (run->bitmap[i] == 0) {
+        i++;
     }
+    int bit = __builtin_ctzll(run->bitmap[i]);
+    run->bitmap[i] &= run->bitmap[i] - 1;
+    if (--run->free_slots == 0) {
+        run_unlink(run);
+    }
+    size_t slot = (size_t)i * 64 + bit;
+    return (char *)run + round_up(sizeof(run_t), dsize) + slot * slot_size;
 }
+
 /*
- * <what does find_fit do?>
- * find_fit - Find a fit for a block with asize bytes in the free list
+ * run_free - marks a slot free again. A run that runs empty is given back
+ *            to the heap unless it is the last listed run of its size,
+ *            which is kept until the heap runs short.
  */
-// Nth Fit Strategy with segregated free lists
+static void run_free(run_t *run, void *bp)
+{
+    size_t slot = (size_t)((char *)bp - (char *)run
+                           - round_up(sizeof(run_t), dsize)) / run->slot_size;
+    run->bitmap[slot / 64] |= (word_t)1 << (slot % 64);
+    if (run->free_slots++ == 0) {
+        run_link(run);
+    }
+    if (run->free_slots == run->num_slots
+        && (run->next != NULL || run->prev != NULL)) {
+        run_destroy(run);
+    }
+}
 
-static block_t *find_fit(size_t asize) {
-    block_t *best_fit = NULL;
-    size_t min_size_diff = SIZE_MAX;
-    int search_iterations = 0;
-    const int max_iterations = 12;  // Define a limit for search iterations
+/*
+ * run_destroy - gives an empty run back to the heap.
+ */
+static void run_destroy(run_t *run)
+{
+    run_unlink(run);
+    run_map[((char *)run - run_map_base) / RUN_SIZE] = 0;
+    free_block(run->arena, payload_to_header(run));
+}
 
-    int start_index = get_free_list_index(asize);
+/*
+ * run_drain - gives the empty runs an arena keeps back to the heap.
+ *             Returns whether there were any.
+ */
+static bool run_drain(arena_t *arena)
+{
+    bool drained = false;
     int i;
-    for (i = start_index; i < NUM_FREE_LISTS; i++) {
-        block_t *block;
-        for (block = free_list_heads[i]; block != NULL; block = block->next_free) {
-            // Check if the block is free and large enough
-            if (!get_alloc(block) && asize <= get_size(block)) {
-                size_t size_diff = get_size(block) - asize;
-
-                // Update best fit if this block is a better fit
-                if (size_diff < min_size_diff) {
-                    best_fit = block;
-                    min_size_diff = size_diff;
-                }
-
-                // If the search has gone on for too long, return the current block if it's good enough
-                if (++search_iterations >= max_iterations) {
-                    if (best_fit != NULL) {
-                        return best_fit;
-                    }
-                    // If we haven't found any fit yet, return this block
-                    if (asize <= get_size(block)) {
-                        return block;
-                    }
-                }
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        run_t *run = arena->runs[i];
+        while (run != NULL) {
+            run_t *next = run->next;
+            if (run->free_slots == run->num_slots) {
+                run_destroy(run);
+                drained = true;
             }
+            run = next;
         }
     }
-    return best_fit; // Return the best fit found, or NULL if none found
+    return drained;
 }
 
+/*
+ * run_link - puts a run with free slots at the head of its arena's list.
+ */
+static void run_link(run_t *run)
+{
+    run_t **head = &run->arena->runs[run->slot_size / dsize - 1];
+    run->prev = NULL;
+    run->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = run;
+    }
+    *head = run;
+}
 
-/* 
- * <what does your heap checker do?>
- * Please keep modularity in mind when you're writing the heap checker!
+/*
+ * run_unlink - takes a run off its arena's list.
  */
-bool mm_checkheap(int line)  
-{ 
-    block_t *current = heap_start;
-    // Check if the heap has been initialized
-    if (current == NULL) {
-        dbg_printf("Heap is not initialized.\n");
-        return false;
+static void run_unlink(run_t *run)
+{
+    if (run->prev == NULL) {
+        run->arena->runs[run->slot_size / dsize - 1] = run->next;
+    } else {
+        run->prev->next = run->next;
     }
-    while(get_size(current)==0)
-    {
-        current = find_next(current);
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
     }
-    while (get_size(current) > 0) {
-        // Check alignment of each block
-        dbg_printf("checkHeap: Payload is at line %d, address: %p\n", line, header_to_payload(current));
-        if (((size_t)header_to_payload(current) % dsize) != 0) {
-            dbg_printf("Error: Block not aligned at line %d\n", line);
-            return false;
-        }
+    run->prev = NULL;
+    run->next = NULL;
+}
 
-        // Check if each block's size meets the minimum block size requirement
-        if (get_size(current) < min_block_size) {
-            dbg_printf("Error: Block size is less than minimum at line %d\n", line);
-            return false;
-        }
+/*
+ * mm_set_slab_max - serves requests of up to size bytes, at most
+ *     SLAB_MAX_SIZE, from slab runs; 0 turns them off. Slots already
+ *     handed out stay valid whatever the setting.
+ */
+void mm_set_slab_max(size_t size)
+{
+    slab_max = size < SLAB_MAX_SIZE ? size : SLAB_MAX_SIZE;
+}
 
-        // For free blocks, check if headers and footers match
-        if (!get_alloc(current)) {
-            word_t *footerp = (word_t *)((current->payload) + get_size(current) - dsize);
-            if (current->header != *footerp) {
-                dbg_printf("Error: Header and footer do not match at line %d\n", line);
-                return false;
-            }
-        }
+/*
+ * mm_set_policy - picks how free blocks below TREE_MIN_SIZE are chosen;
+ *     bigger ones always get the tree's exact best fit. cap bounds the
+ *     scan of capped best fit and of the default good fit's fallback;
+ *     0 restores the default.
+ */
+void mm_set_policy(mm_policy_t policy, int cap)
+{
+    fit_policy = policy;
+    fit_cap = cap > 0 ? cap : default_fit_cap;
+}
 
-        // Check for contiguous free blocks that have not been coalesced
-        if (!get_alloc(current) && !get_alloc(find_next(current))) {
-            dbg_printf("Error: Contiguous free blocks not coalesced at line %d\n", line);
-            return false;
-        }
+/*
+ * mm_cache_stats - reports how many small requests were made since
+ *     mm_init and how many of them the thread caches served, counting
+ *     the calling thread and every thread that has since exited.
+ */
+void mm_cache_stats(size_t *hits, size_t *lookups)
+{
+    *hits = __atomic_load_n(&tcache_hits, __ATOMIC_RELAXED);
+    *lookups = __atomic_load_n(&tcache_lookups, __ATOMIC_RELAXED);
+    if (tcache_valid()) {
+        *hits += tcache.hits;
+        *lookups += tcache.lookups;
+    }
+}
 
-        current = find_next(current);
+/*
+ * mm_get_stats - copies the event counters into out and fills in the
+ *     heap figures from a walk over every segment. Blocks held by the
+ *     thread caches, the quick lists and slab runs count as allocated.
+ */
+void mm_get_stats(mm_stats_t *out)
+{
+    *out = stats;
+    out->counted = MM_STATS;
+    out->heap_bytes = mem_heapsize();
+    out->free_bytes = 0;
+    out->allocated_bytes = 0;
+    memset(out->free_blocks, 0, sizeof(out->free_blocks));
+    if (heap_start == NULL) {
+        return;
     }
 
-    // Check the final block for correctness
-    if (!get_alloc(current) || get_size(current) != 0) {
-        dbg_printf("Error: Final block is not correct at line %d\n", line);
-        return false;
+    word_t *prologue = (word_t *)mem_heap_lo();
+    char *heap_end = (char *)mem_heap_hi() + 1;
+    while ((char *)prologue < heap_end) {
+        block_t *block = (block_t *)(prologue + 1);
+        for (; get_size(block) > 0; block = find_next(block)) {
+            size_t size = get_size(block);
+            if (get_alloc(block)) {
+                out->allocated_bytes += size;
+            } else {
+                out->free_bytes += size;
+                out->free_blocks[63 - __builtin_clzll(size)]++;
+            }
+        }
+        prologue = (word_t *)block + 1;
+    }
+}
+
+/*
+ * stat_add - adds n to an event counter when they are compiled in.
+ */
+static void stat_add(size_t *counter, size_t n)
+{
+    if (MM_STATS) {
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
     }
-    dbg_printf("check-heap passed\n");
-    (void) line;
-    return true;
 }
 
 
+/*
+ * mapping_insert: computes the two-level class (*fl, *sl) that a free
+ *                 block of the given size is filed under.
+ */
+static void mapping_insert(size_t size, int *fl, int *sl)
+{
+    if (size < CLASS_TABLE_LIMIT) {
+        int k = class_index[size >> ALIGN_SIZE_LOG2];
+        *fl = k >> SL_INDEX_COUNT_LOG2;
+        *sl = k & (SL_INDEX_COUNT - 1);
+    } else {
+        int msb = 63 - __builtin_clzll(size);
+        *sl = (int)(size >> (msb - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = msb - FL_INDEX_SHIFT + 1;
+    }
+}
 
-static int get_free_list_index(size_t size) {
-    if (size <= 64) return 0;
-    else if (size <= 128) return 1;
-    else if (size <= 256) return 2;
-    else if (size <= 512) return 3;
-    else {
-        int index = 4;
-        size_t current_size = 1024;
-        while (size > current_size && index < (NUM_FREE_LISTS - 1)) {
-            current_size *= 2;
-            index++;
+/*
+ * mapping_search: like mapping_insert, but first rounds size up to the
+ *                 next class boundary so that every block in the
+ *                 resulting class (or any later one) is large enough.
+ */
+static void mapping_search(size_t size, int *fl, int *sl)
+{
+    if (size < CLASS_TABLE_LIMIT) {
+        int k = class_index[size >> ALIGN_SIZE_LOG2];
+        if (class_bounds[k] != size) {
+            size = k + 1 < CLASS_TABLE_COUNT
+                ? class_bounds[k + 1] : CLASS_TABLE_LIMIT;
         }
-        return index;
+    } else {
+        int msb = 63 - __builtin_clzll(size);
+        size += ((size_t)1 << (msb - SL_INDEX_COUNT_LOG2)) - 1;
     }
+    mapping_insert(size, fl, sl);
 }
 
 
@@ -554,10 +3126,22 @@ static size_t round_up(size_t size, size_t n)
 /*
  * pack: returns a header reflecting a specified size and its alloc status.
  *       If the block is allocated, the lowest bit is set to 1, and 0 otherwise.
+ *       If the previous block is allocated, the second bit is set to 1,
+ *       and if it is a mini block, the third bit is set to 1.
  */
-static word_t pack(size_t size, bool alloc)
+static word_t pack(size_t size, bool alloc, bool prev_alloc, bool prev_mini)
 {
-    return alloc ? (size | alloc_mask) : size;
+    word_t word = size;
+    if (alloc) {
+        word |= alloc_mask;
+    }
+    if (prev_alloc) {
+        word |= prev_alloc_mask;
+    }
+    if (prev_mini) {
+        word |= prev_mini_mask;
+    }
+    return word;
 }
 
 
@@ -567,6 +3151,9 @@ static word_t pack(size_t size, bool alloc)
  */
 static size_t extract_size(word_t word)
 {
+    if (word & mini_free_mask) {
+        return mini_block_size;
+    }
     return (word & size_mask);
 }
 
@@ -580,13 +3167,13 @@ static size_t get_size(block_t *block)
 }
 
 /*
- * get_payload_size: returns the payload size of a given block, equal to
- *                   the entire block size minus the header and footer sizes.
+ * get_payload_size: returns the payload size of a given allocated block,
+ *                   equal to the entire block size minus the header size.
  */
 static word_t get_payload_size(block_t *block)
 {
     size_t asize = get_size(block);
-    return asize - dsize;
+    return asize - wsize;
 }
 
 /*
@@ -607,25 +3194,176 @@ static bool get_alloc(block_t *block)
     return extract_alloc(block->header);
 }
 
+/*
+ * extract_prev_alloc: returns the allocation status of the previous block
+ *                     recorded in a given header value.
+ */
+static bool extract_prev_alloc(word_t word)
+{
+    return (bool)(word & prev_alloc_mask);
+}
+
+/*
+ * get_prev_alloc: returns true when the block preceding this one on the
+ *                 heap is allocated, based on the header's second bit.
+ */
+static bool get_prev_alloc(block_t *block)
+{
+    return extract_prev_alloc(block->header);
+}
+
+/*
+ * set_prev_alloc: updates the prev_alloc bit in the block header, leaving
+ *                 its size and allocation status untouched.
+ */
+static void set_prev_alloc(block_t *block, bool prev_alloc)
+{
+    if (prev_alloc) {
+        block->header |= prev_alloc_mask;
+    } else {
+        block->header &= ~prev_alloc_mask;
+    }
+}
+
+/*
+ * extract_prev_mini: returns whether the previous block is a mini block,
+ *                    as recorded in a given header value.
+ */
+static bool extract_prev_mini(word_t word)
+{
+    return (bool)(word & prev_mini_mask);
+}
+
+/*
+ * get_prev_mini: returns true when the block preceding this one on the
+ *                heap is a mini block, based on the header's third bit.
+ */
+static bool get_prev_mini(block_t *block)
+{
+    return extract_prev_mini(block->header);
+}
+
+/*
+ * set_prev_mini: updates the prev_mini bit in the block header, leaving
+ *                everything else untouched.
+ */
+static void set_prev_mini(block_t *block, bool prev_mini)
+{
+    if (prev_mini) {
+        block->header |= prev_mini_mask;
+    } else {
+        block->header &= ~prev_mini_mask;
+    }
+}
+
+/*
+ * get_mini_prev: returns the predecessor of a free mini block on the mini
+ *                list, kept in the size bits of its header. Headers sit one
+ *                word below an aligned payload, so that word is added back.
+ */
+static block_t *get_mini_prev(block_t *block)
+{
+    dbg_requires(block->header & mini_free_mask);
+    word_t prev = block->header & size_mask;
+    return prev == 0 ? NULL : (block_t *)(prev | wsize);
+}
+
+/*
+ * set_mini_prev: marks a free mini block as listed and records its
+ *                predecessor on the mini list, keeping the status bits.
+ */
+static void set_mini_prev(block_t *block, block_t *prev)
+{
+    block->header = ((word_t)prev & size_mask) | mini_free_mask
+        | (block->header & (alloc_mask | prev_alloc_mask | prev_mini_mask));
+}
+
 /*
  * write_header: given a block and its size and allocation status,
  *               writes an appropriate value to the block header.
  */
-static void write_header(block_t *block, size_t size, bool alloc)
+static void write_header(block_t *block, size_t size, bool alloc,
+                         bool prev_alloc, bool prev_mini)
 {
-    block->header = pack(size, alloc);
+    block->header = pack(size, alloc, prev_alloc, prev_mini);
 }
 
 
 /*
- * write_footer: given a block and its size and allocation status,
+ * write_footer: given a free block and its size and allocation status,
  *               writes an appropriate value to the block footer by first
- *               computing the position of the footer.
+ *               computing the position of the footer. Allocated blocks
+ *               and mini blocks have no footer.
  */
 static void write_footer(block_t *block, size_t size, bool alloc)
 {
+    dbg_requires(!alloc);
+    if (size == mini_block_size) {
+        return;
+    }
     word_t *footerp = (word_t *)((block->payload) + get_size(block) - dsize);
-    *footerp = pack(size, alloc);
+    *footerp = pack(size, alloc, false, false);
+}
+
+/*
+ * get_zeroed: returns whether a free block is known to be zero apart
+ *             from its boundary tags and links. Mini blocks never are.
+ */
+static bool get_zeroed(block_t *block)
+{
+    size_t size = get_size(block);
+    if (size == mini_block_size) {
+        return false;
+    }
+    word_t *footerp = (word_t *)((block->payload) + size - dsize);
+    return (bool)(*footerp & zeroed_mask);
+}
+
+/*
+ * set_zeroed: records in the footer of a free block whether it is known
+ *             to be zero. Mini blocks have no footer to record it in.
+ */
+static void set_zeroed(block_t *block, bool zeroed)
+{
+    size_t size = get_size(block);
+    if (size == mini_block_size) {
+        return;
+    }
+    word_t *footerp = (word_t *)((block->payload) + size - dsize);
+    if (zeroed) {
+        *footerp |= zeroed_mask;
+    } else {
+        *footerp &= ~zeroed_mask;
+    }
+}
+
+/*
+ * clear_free_words: zeroes the payload words of a block just placed in a
+ *                   zeroed free block that still hold its links and, if
+ *                   the block was not split, its footer.
+ */
+static void clear_free_words(block_t *block)
+{
+    size_t psize = get_payload_size(block);
+    size_t links = link_words * wsize;
+    memset(block->payload, 0, psize < links ? psize : links);
+    memset(block->payload + psize - wsize, 0, wsize);
+}
+
+/*
+ * erase_tags: zeroes what parts a zeroed free block from the free block
+ *             before it when the two merge: that block's footer, and our
+ *             own header, links and footer.
+ */
+static void erase_tags(block_t *block)
+{
+    size_t size = get_size(block);
+    size_t links = link_words * wsize;
+    if (links > size - dsize) {
+        links = size - dsize;
+    }
+    memset(find_prev_footer(block), 0, dsize + links);
+    memset((char *)block + size - wsize, 0, wsize);
 }
 
 
@@ -654,10 +3392,16 @@ static word_t *find_prev_footer(block_t *block)
 /*
  * find_prev: returns the previous block position by checking the previous
  *            block's footer and calculating the start of the previous block
- *            based on its size.
+ *            based on its size. Only valid when the previous block is free.
+ *            A previous mini block has no footer; its size is implied by
+ *            the prev_mini bit.
  */
 static block_t *find_prev(block_t *block)
 {
+    dbg_requires(!get_prev_alloc(block));
+    if (get_prev_mini(block)) {
+        return (block_t *)((char *)block - mini_block_size);
+    }
     word_t *footerp = find_prev_footer(block);
     size_t size = extract_size(*footerp);
     return (block_t *)((char *)block - size);
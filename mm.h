@@ -23,3 +23,103 @@ extern bool mm_init(void);
 
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
+
+/* Thread cache hits and small requests since mm_init */
+extern void mm_cache_stats(size_t *hits, size_t *lookups);
+
+/* Park small freed blocks on quick lists, merging them only on demand */
+extern void mm_set_deferred_coalescing(bool on);
+
+/* Serve requests of at least threshold bytes from their own mappings */
+extern void mm_set_mmap_threshold(size_t threshold);
+
+/* Give back the heap's free tail once it exceeds threshold bytes */
+extern void mm_set_trim_threshold(size_t threshold);
+
+/* Serve requests of up to size bytes from slab runs; 0 turns them off */
+extern void mm_set_slab_max(size_t size);
+
+/* How a free block is chosen for a request below the tree's sizes */
+typedef enum {
+    MM_FIT_GOOD,        /* a class sure to fit, else capped best fit (default) */
+    MM_FIT_FIRST,       /* first fit in the request's class */
+    MM_FIT_NEXT,        /* first fit from where the last search ended */
+    MM_FIT_BEST,        /* best fit among the first cap blocks of the class */
+    MM_FIT_EXACT,       /* best fit over the whole class */
+    MM_FIT_SEGREGATED,  /* the head of the class, if it fits */
+    MM_FIT_POLICIES
+} mm_policy_t;
+
+/* Pick the placement policy; cap bounds capped scans, 0 for the default */
+extern void mm_set_policy(mm_policy_t policy, int cap);
+
+/* Allocate n blocks of size bytes into out; returns how many were */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+
+/* Free the n blocks in ptrs, which are sorted by address on the way */
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* Free ptr, whose last request was for size bytes */
+extern void mm_free_sized(void *ptr, size_t size);
+
+/* Allocate size bytes aligned to align, a power of two */
+extern void *mm_memalign(size_t align, size_t size);
+extern void *mm_aligned_alloc(size_t align, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t align, size_t size);
+
+/* Bytes usable at ptr, at least the size it was requested with */
+extern size_t mm_malloc_usable_size(void *ptr);
+
+/* Malloc that reports in *actual how many bytes the block holds */
+extern void *mm_malloc_at_least(size_t size, size_t *actual);
+
+/* Sizes are counted by class: class i holds 2^i to 2^(i+1)-1 bytes */
+#define MM_STATS_CLASSES 64
+
+/* find_fit calls are counted by blocks looked at, the last bucket for more */
+#define MM_STATS_DEPTHS 16
+
+/*
+ * Allocator statistics. The event counters run from mm_init and are only
+ * kept when mm.c is built with -DMM_STATS=1; the heap figures are taken
+ * by mm_get_stats itself.
+ */
+typedef struct {
+    bool counted;               /* were the event counters compiled in? */
+
+    /* Calls per entry point */
+    size_t malloc_calls;
+    size_t calloc_calls;
+    size_t realloc_calls;
+    size_t free_calls;
+    size_t free_sized_calls;
+    size_t memalign_calls;
+    size_t malloc_batch_calls;
+    size_t free_batch_calls;
+
+    /* Work done on the heap */
+    size_t fit_searches;        /* find_fit calls */
+    size_t fit_steps;           /* list blocks and tree nodes they visited */
+    size_t fit_depth[MM_STATS_DEPTHS]; /* calls by steps; 0 for bitmap hits */
+    size_t fit_capped;          /* list scans cut short by the iteration cap */
+    size_t fit_misses;          /* calls that found no block */
+    size_t fit_hits[MM_STATS_CLASSES];  /* fits found, by request class ... */
+    size_t fit_waste[MM_STATS_CLASSES]; /* ... and their bytes beyond it */
+    size_t extend_calls;        /* heap extensions ... */
+    size_t extend_bytes;        /* ... and the bytes they added */
+    size_t trim_calls;          /* heap trims ... */
+    size_t trim_bytes;          /* ... and the bytes they gave back */
+    size_t splits;              /* blocks split on placing or shrinking */
+    size_t coalesce[4];         /* merges by neighbours: [2 * prev free + next free] */
+    size_t realloc_copies;      /* reallocs that moved the payload ... */
+    size_t realloc_copy_bytes;  /* ... and the bytes they copied */
+
+    /* Heap at the time of the call */
+    size_t heap_bytes;
+    size_t free_bytes;
+    size_t allocated_bytes;     /* including cached blocks and slab runs */
+    size_t free_blocks[MM_STATS_CLASSES];
+} mm_stats_t;
+
+/* Fill in stats; call while no other thread uses the allocator */
+extern void mm_get_stats(mm_stats_t *stats);
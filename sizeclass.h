@@ -0,0 +1,49 @@
+/*
+ * sizeclass.h - Free list classes for blocks below
+ *     CLASS_TABLE_LIMIT bytes, fitted to the request sizes of:
+ *         traces/bdd-aa32.rep
+ *         traces/bdd-aa4.rep
+ *         traces/bdd-ma4.rep
+ *         traces/bdd-nq7.rep
+ *         traces/cbit-abs.rep
+ *         traces/cbit-parity.rep
+ *         traces/cbit-satadd.rep
+ *         traces/cbit-xyz.rep
+ *         traces/ngram-fox1.rep
+ *         traces/ngram-gulliver1.rep
+ *         traces/ngram-gulliver2.rep
+ *         traces/ngram-moby1.rep
+ *         traces/ngram-shake1.rep
+ *         traces/syn-align.rep
+ *         traces/syn-array-short.rep
+ *         traces/syn-array.rep
+ *         traces/syn-batch.rep
+ *         traces/syn-mix-realloc.rep
+ *         traces/syn-mix-short.rep
+ *         traces/syn-mix.rep
+ *         traces/syn-string-short.rep
+ *         traces/syn-string.rep
+ *         traces/syn-struct-short.rep
+ *         traces/syn-struct.rep
+ *
+ * Generated by mkclasses; regenerate with make classes.
+ */
+
+#define CLASS_TABLE_LIMIT 1024
+#define CLASS_TABLE_COUNT 32
+
+/* Smallest block size of each class */
+static const uint16_t class_bounds[CLASS_TABLE_COUNT] = {
+    0, 16, 32, 48, 64, 80, 96, 112,
+    128, 144, 160, 176, 192, 208, 224, 240,
+    256, 272, 304, 336, 384, 432, 480, 528,
+    576, 624, 672, 720, 768, 832, 896, 960
+};
+
+/* Class of each block size / ALIGN_SIZE */
+static const uint8_t class_index[CLASS_TABLE_LIMIT >> 4] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 17, 17, 18, 18, 19, 19, 19, 20, 20, 20, 21, 21, 21, 22, 22,
+    22, 23, 23, 23, 24, 24, 24, 25, 25, 25, 26, 26, 26, 27, 27, 27,
+    28, 28, 28, 28, 29, 29, 29, 29, 30, 30, 30, 30, 31, 31, 31, 31
+};